@@ -17,23 +17,28 @@
 #endif
 
 #include "cogment/actor.h"
+#include "cogment/async_client.h"
 #include "cogment/utils.h"
 #include "cogment/config_file.h"
 #include "cogment/trial.h"
 
+#include <algorithm>
+
 namespace {
 
-float compute_reward_value(const cogmentAPI::Reward& reward) {
+constexpr uint64_t WIRETYPE_LENGTH_DELIMITED = 2;
+
+// The sources are in the order received, so the result is the same as accumulating them one by one
+float compute_reward_value(const uint64_t* tick_ids, const float* values, const float* confidences, size_t nb_rows,
+                           uint64_t tick_id) {
   float value_accum = 0.0f;
   float confidence_accum = 0.0f;
 
-  for (auto& src : reward.sources()) {
-    float src_conf = src.confidence();
-
-    if (src_conf > 0.0f) {
-      value_accum += src.value() * src_conf;
-      confidence_accum += src_conf;
-    }
+  // Branchless, so the products and selections can be vectorized
+  for (size_t row = 0; row < nb_rows; row++) {
+    const bool valid = (tick_ids[row] == tick_id && confidences[row] > 0.0f);
+    value_accum += (valid ? values[row] * confidences[row] : 0.0f);
+    confidence_accum += (valid ? confidences[row] : 0.0f);
   }
 
   if (confidence_accum > 0.0f) {
@@ -47,6 +52,50 @@ float compute_reward_value(const cogmentAPI::Reward& reward) {
 
 namespace cogment {
 
+const grpc::ByteBuffer& SharedActorInput::serialized() {
+  std::call_once(m_serialized_once, [this]() {
+    m_serialized = SerializeMessage(m_data);
+  });
+
+  return m_serialized;
+}
+
+SharedActorMessage::SharedActorMessage(const cogmentAPI::Message& message, uint64_t tick_id) : m_message(message) {
+  m_message.set_tick_id(tick_id);
+  m_message.clear_receiver_name();
+}
+
+void SharedActorMessage::make_input(const std::string& receiver_name, cogmentAPI::ActorRunTrialInput* out) const {
+  out->set_state(cogmentAPI::CommunicationState::NORMAL);
+  auto message = out->mutable_message();
+  *message = m_message;
+  message->set_receiver_name(receiver_name);
+}
+
+// The receiver name field is appended after the other (shared) fields of the message, which is valid protobuf
+// encoding: only the length of the message field differs between receivers.
+grpc::ByteBuffer SharedActorMessage::serialized(const std::string& receiver_name) {
+  std::call_once(m_serialized_once, [this]() {
+    cogmentAPI::ActorRunTrialInput state_only;
+    state_only.set_state(cogmentAPI::CommunicationState::NORMAL);
+    m_serialized_state = grpc::Slice(state_only.SerializeAsString());
+    m_serialized_message = grpc::Slice(m_message.SerializeAsString());
+  });
+
+  cogmentAPI::Message receiver_only;
+  receiver_only.set_receiver_name(receiver_name);
+  const std::string serialized_receiver = receiver_only.SerializeAsString();
+
+  std::string message_header;
+  append_varint(&message_header,
+                (cogmentAPI::ActorRunTrialInput::kMessageFieldNumber << 3) | WIRETYPE_LENGTH_DELIMITED);
+  append_varint(&message_header, m_serialized_message.size() + serialized_receiver.size());
+
+  grpc::Slice slices[] = {m_serialized_state, grpc::Slice(message_header), m_serialized_message,
+                          grpc::Slice(serialized_receiver)};
+  return grpc::ByteBuffer(slices, std::size(slices));
+}
+
 void ManagedStream::operator=(std::unique_ptr<ActorStream> stream) {
   // Testing the locks is very hard due to spurious false return of try_lock.
   // In our use case, this following test is good enough.
@@ -57,6 +106,17 @@ void ManagedStream::operator=(std::unique_ptr<ActorStream> stream) {
   m_stream_valid = true;
 }
 
+void ManagedStream::start(ActorStream::ReadHandler&& on_read, ActorStream::DoneHandler&& on_done) {
+  if (!m_stream_valid) {
+    throw MakeException("Cannot start an invalid managed stream");
+  }
+
+  m_stream->start(std::move(on_read), [this, on_done = std::move(on_done)]() {
+    m_stream_valid = false;
+    on_done();
+  });
+}
+
 bool ManagedStream::read(ActorStream::OutputType* data) {
   const std::lock_guard lg(m_reading);
   if (m_stream_valid) {
@@ -74,13 +134,14 @@ bool ManagedStream::read(ActorStream::OutputType* data) {
   return m_stream_valid;
 }
 
-bool ManagedStream::write(const ActorStream::InputType& data) {
+template <class... DataTypes>
+bool ManagedStream::write_data(DataTypes&&... data) {
   const std::lock_guard lg(m_writing);
   if (m_stream_valid) {
     if (!m_last_writen) {
       try {
         // We never want to set m_stream_valid to "true", so we use an "if" statement
-        if (!m_stream->write(data)) {
+        if (!m_stream->write(std::forward<DataTypes>(data)...)) {
           m_stream_valid = false;
         }
       }
@@ -97,7 +158,183 @@ bool ManagedStream::write(const ActorStream::InputType& data) {
   return m_stream_valid;
 }
 
+template <class FillFunc>
+bool ManagedStream::enqueue(bool last, FillFunc&& fill) {
+  std::unique_lock ul(m_queue_lock);
+
+  if (!m_stream_valid) {
+    return false;
+  }
+  if (m_last_queued) {
+    spdlog::warn("Trying to write after last writen");
+    return true;
+  }
+
+  QueuedWrite* entry;
+  if (!m_queue->full()) {
+    entry = &m_queue->push_back();
+  }
+  else if (last) {
+    entry = &m_held_last;
+    m_last_held = true;
+  }
+  else {
+    // The actor is not keeping up: no write can be skipped, so the stream cannot be used anymore
+    // (the remaining queued writes are discarded by the drain).
+    m_stream_valid = false;
+    m_overflowed = true;
+    if (m_queue_metrics.overflows != nullptr) {
+      m_queue_metrics.overflows->Increment();
+    }
+    return false;
+  }
+
+  entry->data.Clear();
+  fill(entry);
+  entry->last = last;
+  entry->timestamp = Timestamp();
+  m_last_queued = last;
+  if (m_queue_metrics.depth != nullptr) {
+    m_queue_metrics.depth->Increment();
+  }
+
+  const bool start_drain = !m_draining;
+  m_draining = true;
+  ul.unlock();
+
+  if (start_drain) {
+    m_queue_pool->push("Actor outbound queue", [this]() {
+      drain_queue();
+    });
+  }
+
+  return true;
+}
+
+// Only one drain runs at a time, so the writes are sent in order.
+// The front entry is not touched by producers while the lock is released because they only add at the back.
+// The held last write is sent after the queue (nothing is queued after it).
+void ManagedStream::drain_queue() {
+  std::unique_lock ul(m_queue_lock);
+  while (!m_queue->empty() || m_last_held) {
+    const bool from_queue = !m_queue->empty();
+    auto& entry = (from_queue) ? m_queue->front() : m_held_last;
+    ul.unlock();
+
+    const uint64_t start = Timestamp();
+    if (m_queue_metrics.lag != nullptr) {
+      const uint64_t lag = (start > entry.timestamp) ? (start - entry.timestamp) : 0;
+      m_queue_metrics.lag->Observe(static_cast<double>(lag) * NANOS_INV);
+    }
+
+    if (entry.last) {
+      write_last_data(entry.data);
+    }
+    else if (entry.shared_data != nullptr) {
+      write_data(entry.shared_data.get());
+    }
+    else {
+      write_data(entry.data);
+    }
+    entry.shared_data.reset();
+
+    if (m_queue_metrics.write_time != nullptr) {
+      const uint64_t end = Timestamp();
+      const uint64_t duration = (end > start) ? (end - start) : 0;
+      m_queue_metrics.write_time->Observe(static_cast<double>(duration) * NANOS_INV);
+    }
+
+    ul.lock();
+    if (from_queue) {
+      m_queue->pop_front();
+    }
+    else {
+      m_last_held = false;
+    }
+    if (m_queue_metrics.depth != nullptr) {
+      m_queue_metrics.depth->Decrement();
+    }
+  }
+
+  m_draining = false;
+  m_queue_cond.notify_all();
+}
+
+void ManagedStream::wait_queue_drained() {
+  if (!m_queued) {
+    return;
+  }
+
+  std::unique_lock ul(m_queue_lock);
+  m_queue_cond.wait(ul, [this]() {
+    return !m_draining;
+  });
+}
+
+void ManagedStream::start_queue(ThreadPool* pool, const ActorQueueOptions& options, const std::string& actor_class) {
+  if (m_queued || options.max_size == 0) {
+    return;
+  }
+  if (is_async()) {
+    throw MakeException("Asynchronous actor streams cannot be queued");
+  }
+
+  m_queue_pool = pool;
+  const prometheus::Labels labels {{"actor_class", actor_class}};
+  if (options.metrics.depth != nullptr) {
+    m_queue_metrics.depth = &(options.metrics.depth->Add(labels));
+  }
+  if (options.metrics.write_time != nullptr) {
+    m_queue_metrics.write_time = &(options.metrics.write_time->Add(labels, prometheus::Summary::Quantiles()));
+  }
+  if (options.metrics.lag != nullptr) {
+    m_queue_metrics.lag = &(options.metrics.lag->Add(labels, prometheus::Summary::Quantiles()));
+  }
+  if (options.metrics.overflows != nullptr) {
+    m_queue_metrics.overflows = &(options.metrics.overflows->Add(labels));
+  }
+  m_queue = std::make_unique<RingBuffer<QueuedWrite>>(options.max_size);
+  m_last_queued = m_last_writen;
+  m_queued = true;
+}
+
+bool ManagedStream::write(const ActorStream::InputType& data) {
+  if (m_queued) {
+    return enqueue(false, [&data](QueuedWrite* entry) {
+      entry->data = data;
+    });
+  }
+  return write_data(data);
+}
+
+bool ManagedStream::write(const std::shared_ptr<SharedActorInput>& data) {
+  if (m_queued) {
+    return enqueue(false, [&data](QueuedWrite* entry) {
+      entry->shared_data = data;
+    });
+  }
+  return write_data(data.get());
+}
+
+bool ManagedStream::write(SharedActorMessage* data, const std::string& receiver_name) {
+  if (m_queued) {
+    return enqueue(false, [data, &receiver_name](QueuedWrite* entry) {
+      data->make_input(receiver_name, &entry->data);
+    });
+  }
+  return write_data(data, receiver_name);
+}
+
 bool ManagedStream::write_last(const ActorStream::InputType& data) {
+  if (m_queued) {
+    return enqueue(true, [&data](QueuedWrite* entry) {
+      entry->data = data;
+    });
+  }
+  return write_last_data(data);
+}
+
+bool ManagedStream::write_last_data(const ActorStream::InputType& data) {
   const std::lock_guard lg(m_writing);
   if (m_stream_valid) {
     if (!m_last_writen) {
@@ -123,6 +360,8 @@ bool ManagedStream::write_last(const ActorStream::InputType& data) {
 }
 
 void ManagedStream::finish() {
+  wait_queue_drained();
+
   const std::lock_guard lg(m_writing);
   if (m_stream_valid) {
     m_stream_valid = false;
@@ -135,68 +374,120 @@ void ManagedStream::finish() {
   }
 }
 
+// Queued streams are synchronous (they cannot be corked), and the writing lock
+// may be held by the queue drain for a long time.
+void ManagedStream::cork() {
+  if (m_queued) {
+    return;
+  }
+
+  const std::lock_guard lg(m_writing);
+  if (m_stream_valid) {
+    m_stream->cork();
+  }
+}
+
+void ManagedStream::uncork() {
+  if (m_queued) {
+    return;
+  }
+
+  const std::lock_guard lg(m_writing);
+  if (m_stream_valid) {
+    m_stream->uncork();
+  }
+}
+
+void ManagedStream::close() {
+  m_stream_valid = false;
+  if (m_stream != nullptr) {
+    // Not under lock since the handlers of asynchronous streams may be using the stream
+    m_stream->close();
+  }
+
+  wait_queue_drained();
+
+  const std::lock_guard lg(m_writing);
+  m_stream.reset();
+}
+
 // Static
-bool Actor::read_init_data(ActorStream* stream, cogmentAPI::ActorInitialOutput* out) {
-  SPDLOG_TRACE("Actor read_init_data");
+Actor::InitDataStatus Actor::process_init_data(ActorStream* stream, ActorStream::OutputType&& data,
+                                               cogmentAPI::ActorInitialOutput* out) {
+  const auto state = data.state();
+  const auto data_case = data.data_case();
 
-  for (ActorStream::OutputType data; stream->read(&data); data.Clear()) {
-    const auto state = data.state();
-    const auto data_case = data.data_case();
-
-    switch (state) {
-    case cogmentAPI::CommunicationState::NORMAL: {
-      if (data_case == ActorStream::OutputType::DataCase::kInitOutput) {
-        if (out != nullptr) {
-          *out = std::move(data.init_output());
-        }
-        return true;
-      }
-      else {
-        throw MakeException("Data [{}] received from before init data", static_cast<int>(data_case));
+  switch (state) {
+  case cogmentAPI::CommunicationState::NORMAL: {
+    if (data_case == ActorStream::OutputType::DataCase::kInitOutput) {
+      if (out != nullptr) {
+        *out = std::move(*data.mutable_init_output());
       }
+      return InitDataStatus::received;
     }
-
-    case cogmentAPI::CommunicationState::HEARTBEAT: {
-      if (data_case == ActorStream::OutputType::DataCase::kDetails) {
-        spdlog::info("Heartbeat requested from actor: [{}]", data.details());
-      }
-      ActorStream::InputType msg;
-      msg.set_state(cogmentAPI::CommunicationState::HEARTBEAT);
-      if (!stream->write(std::move(msg))) {
-        return false;
-      }
-      break;
+    else {
+      throw MakeException("Data [{}] received from before init data", static_cast<int>(data_case));
     }
+  }
 
-    case cogmentAPI::CommunicationState::LAST: {
-      throw MakeException("Unexpected reception of communication state (LAST) from actor");
+  case cogmentAPI::CommunicationState::HEARTBEAT: {
+    if (data_case == ActorStream::OutputType::DataCase::kDetails) {
+      spdlog::info("Heartbeat requested from actor: [{}]", data.details());
     }
-
-    case cogmentAPI::CommunicationState::LAST_ACK: {
-      throw MakeException("Unexpected reception of communication state (LAST_ACK) from actor");
+    ActorStream::InputType msg;
+    msg.set_state(cogmentAPI::CommunicationState::HEARTBEAT);
+    if (!stream->write(std::move(msg))) {
+      return InitDataStatus::ended;
     }
+    return InitDataStatus::waiting;
+  }
 
-    case cogmentAPI::CommunicationState::END: {
-      if (data_case == ActorStream::OutputType::DataCase::kDetails) {
-        spdlog::error("Unexpected end of communication (END) from actor: [{}]", data.details());
-      }
-      else {
-        spdlog::error("Unexpected end of communication (END) from actor");
-      }
-      return false;
+  case cogmentAPI::CommunicationState::LAST: {
+    throw MakeException("Unexpected reception of communication state (LAST) from actor");
+  }
+
+  case cogmentAPI::CommunicationState::LAST_ACK: {
+    throw MakeException("Unexpected reception of communication state (LAST_ACK) from actor");
+  }
+
+  case cogmentAPI::CommunicationState::END: {
+    if (data_case == ActorStream::OutputType::DataCase::kDetails) {
+      spdlog::error("Unexpected end of communication (END) from actor: [{}]", data.details());
     }
+    else {
+      spdlog::error("Unexpected end of communication (END) from actor");
+    }
+    return InitDataStatus::ended;
+  }
+
+  default:
+    throw MakeException("Unknown communication state [{}] received from actor", static_cast<int>(state));
+  }
+}
+
+// Static
+bool Actor::read_init_data(ActorStream* stream, cogmentAPI::ActorInitialOutput* out) {
+  SPDLOG_TRACE("Actor read_init_data");
 
-    default:
-      throw MakeException("Unknown communication state [{}] received from actor", static_cast<int>(state));
+  for (ActorStream::OutputType data; stream->read(&data); data.Clear()) {
+    switch (process_init_data(stream, std::move(data), out)) {
+    case InitDataStatus::received:
+      return true;
+    case InitDataStatus::ended:
+      return false;
+    case InitDataStatus::waiting:
+      break;
     }
   }
 
   return false;
 }
 
-Actor::Actor(Trial* owner, const cogmentAPI::ActorParams& params, bool read_init) :
+Actor::Actor(Trial* owner, uint32_t index, const cogmentAPI::ActorParams& params, bool read_init) :
     m_wait_for_init_data(read_init),
     m_trial(owner),
+    m_index(index),
+    m_tick_bundling(owner->tick_bundling()),
     m_name(params.name()),
     m_actor_class(params.actor_class()),
     m_impl(params.implementation()),
@@ -204,7 +495,8 @@ Actor::Actor(Trial* owner, const cogmentAPI::ActorParams& params, bool read_init
     m_init_completed(false),
     m_last_sent(false),
     m_last_ack_received(false),
-    m_finished(false) {
+    m_finished(false),
+    m_disconnecting(false) {
   if (m_has_config) {
     m_config_data = params.config().content();
   }
@@ -214,62 +506,82 @@ Actor::Actor(Trial* owner, const cogmentAPI::ActorParams& params, bool read_init
 Actor::~Actor() {
   SPDLOG_TRACE("~Actor(): [{}] [{}]", m_trial->id(), m_name);
 
+  if (m_disconnect_fut.valid()) {
+    m_disconnect_fut.wait();
+  }
+
   finish_stream();
 
+  if (m_incoming_thread.valid()) {
+    m_incoming_thread.wait();
+  }
+
+  // For asynchronous streams, this waits until the handlers cannot be called anymore
+  m_stream.close();
+
   if (!m_init_completed) {
     m_init_prom.set_value();
   }
 
   if (!m_last_ack_received) {
-    m_last_ack_prom.set_value();
+    m_last_ack.set();
   }
+}
 
-  if (m_incoming_thread.valid()) {
-    m_incoming_thread.wait();
+void Actor::write_to_stream(const ActorStream::InputType& data) {
+  if (!m_stream.write(data)) {
+    write_failed();
+    throw MakeException("Actor stream has closed");
   }
 }
 
-void Actor::write_to_stream(ActorStream::InputType&& data) {
-  if (!m_stream.write(std::move(data))) {
+void Actor::write_to_stream(const std::shared_ptr<SharedActorInput>& data) {
+  if (!m_stream.write(data)) {
+    write_failed();
     throw MakeException("Actor stream has closed");
   }
 }
 
-void Actor::add_reward_src(const cogmentAPI::RewardSource& source, TickIdType tick_id) {
-  const std::lock_guard lg(m_reward_lock);
-  auto& rew = m_reward_accumulator[tick_id];
-  auto new_src = rew.add_sources();
-  *new_src = source;
+void Actor::write_to_stream(SharedActorMessage* data) {
+  if (!m_stream.write(data, m_name)) {
+    write_failed();
+    throw MakeException("Actor stream has closed");
+  }
 }
 
-void Actor::send_message(const cogmentAPI::Message& message, TickIdType tick_id) {
-  cogmentAPI::Message msg(message);
-  msg.set_tick_id(tick_id);
-  msg.set_receiver_name(m_name);  // Because of possible wildcards in message receiver
+// An actor that does not keep up with its writes (the queue overflowed) is disconnected, like a dead actor.
+// This is done from the thread pool because the writer may be a completion queue thread.
+void Actor::write_failed() {
+  if (!m_stream.has_overflowed() || m_disconnecting.exchange(true)) {
+    return;
+  }
 
-  dispatch_message(std::move(msg));
+  spdlog::warn("Trial [{}] - Actor [{}] is not keeping up (its write queue is full). It will be disconnected.",
+               m_trial->id(), m_name);
+  m_disconnect_fut = m_trial->thread_pool().push("Actor disconnection", [this]() {
+    m_trial->actor_dead(m_index);
+    finish_stream();
+  });
 }
 
-void Actor::dispatch_tick(cogmentAPI::Observation&& obs, bool final_tick) {
-  RewardAccumulator reward_acc;
-  {
-    const std::lock_guard lg(m_reward_lock);
-    reward_acc.swap(m_reward_accumulator);
-  }
+void Actor::add_reward_src(const cogmentAPI::RewardSource* source, TickIdType tick_id) {
+  auto& acc = m_reward_accumulator;
+  acc.tick_ids.emplace_back(tick_id);
+  acc.values.emplace_back(source->value());
+  acc.confidences.emplace_back(source->confidence());
+  acc.sources.emplace_back(source);
+}
 
-  try {
-    for (auto& value : reward_acc) {
-      const auto tick_id = value.first;
-      auto& reward = value.second;
+void Actor::send_message(SharedActorMessage* message) { write_to_stream(message); }
 
-      auto val = compute_reward_value(reward);
-      reward.set_value(val);
-      reward.set_tick_id(tick_id);
-      reward.set_receiver_name(m_name);
-      dispatch_reward(std::move(reward));
-    }
+void Actor::dispatch_tick(const std::shared_ptr<SharedActorInput>& obs, bool final_tick) {
+  if (m_tick_bundling) {
+    m_stream.cork();  // Already corked after the first tick
+  }
 
-    dispatch_observation(std::move(obs), final_tick);
+  try {
+    dispatch_rewards();
+    dispatch_observation(obs, final_tick);
   }
   catch (const std::exception& exc) {
     spdlog::error("Trial [{}] - Actor [{}]: Failed to process outgoing data [{}]", m_trial->id(), m_name, exc.what());
@@ -277,6 +589,17 @@ void Actor::dispatch_tick(cogmentAPI::Observation&& obs, bool final_tick) {
   catch (...) {
     spdlog::error("Trial [{}] - Actor [{}]: Failed to process outgoing data", m_trial->id(), m_name);
   }
+
+  m_reward_accumulator.clear();  // The sources are not valid after this tick
+
+  if (m_tick_bundling) {
+    // Everything written since the last tick is sent at once, and the messages
+    // sent until the next tick will be sent with it.
+    m_stream.uncork();
+    if (!final_tick) {
+      m_stream.cork();
+    }
+  }
 }
 
 void Actor::process_incoming_state(cogmentAPI::CommunicationState in_state, const std::string* details) {
@@ -332,7 +655,7 @@ void Actor::process_incoming_state(cogmentAPI::CommunicationState in_state, cons
     // TODO: Should we accept even if the "LAST" was not sent?
     //       This could be used to indicate that the actor has finished interacting with the trial.
     m_last_ack_received = true;
-    m_last_ack_prom.set_value();
+    m_last_ack.set();
     break;
 
   case cogmentAPI::CommunicationState::END:
@@ -365,7 +688,7 @@ void Actor::process_incoming_data(ActorStream::OutputType&& data) {
 
   case ActorStream::OutputType::DataCase::kAction: {
     if (state == cogmentAPI::CommunicationState::NORMAL) {
-      m_trial->actor_acted(m_name, std::move(*data.mutable_action()));
+      m_trial->actor_acted(m_index, std::move(*data.mutable_action()));
     }
     else {
       throw MakeException("Action received on non-normal communication");
@@ -410,6 +733,40 @@ void Actor::process_incoming_data(ActorStream::OutputType&& data) {
   }
 }
 
+void Actor::process_incoming(ActorStream::OutputType&& data) {
+  if (!m_init_completed && m_wait_for_init_data) {
+    try {
+      const auto status = process_init_data(m_stream.actor_stream_ptr(), std::move(data), nullptr);
+      if (status == InitDataStatus::received) {
+        init_completed();
+      }
+      else if (status == InitDataStatus::ended) {
+        finish_stream();
+      }
+    }
+    catch (const std::exception& exc) {
+      spdlog::error("Trial [{}] - Actor [{}] failed to process stream [{}]", m_trial->id(), m_name, exc.what());
+      finish_stream();
+    }
+    catch (...) {
+      spdlog::error("Trial [{}] - Actor [{}] failed to process stream", m_trial->id(), m_name);
+      finish_stream();
+    }
+
+    return;
+  }
+
+  try {
+    process_incoming_data(std::move(data));
+  }
+  catch (const std::exception& exc) {
+    spdlog::error("Trial [{}] - Actor [{}] failed to process incoming data [{}]", m_trial->id(), m_name, exc.what());
+  }
+  catch (...) {
+    spdlog::error("Trial [{}] - Actor [{}] failed to process incoming data", m_trial->id(), m_name);
+  }
+}
+
 void Actor::process_incoming_stream() {
   for (ActorStream::OutputType data; m_stream.read(&data); data.Clear()) {
     try {
@@ -436,6 +793,23 @@ std::future<void> Actor::run(std::unique_ptr<ActorStream> stream) {
 
   dispatch_init_data();
 
+  if (m_stream.is_async()) {
+    if (!m_wait_for_init_data) {
+      init_completed();
+    }
+
+    m_stream.start(
+        [this](ActorStream::OutputType&& data) {
+          process_incoming(std::move(data));
+        },
+        [this]() {
+          SPDLOG_DEBUG("Trial [{}] - Actor [{}] finished reading stream", m_trial->id(), m_name);
+          finish_stream();
+        });
+
+    return m_finished_prom.get_future();
+  }
+
   m_incoming_thread = m_trial->thread_pool().push("Actor incoming data", [this]() {
     try {
       bool init_success;
@@ -447,10 +821,7 @@ std::future<void> Actor::run(std::unique_ptr<ActorStream> stream) {
       }
 
       if (init_success) {
-        m_init_prom.set_value();
-        m_init_completed = true;
-        spdlog::debug("Trial [{}] - Actor [{}] init complete", m_trial->id(), m_name);
-
+        init_completed();
         process_incoming_stream();
       }
     }
@@ -467,38 +838,65 @@ std::future<void> Actor::run(std::unique_ptr<ActorStream> stream) {
   return m_finished_prom.get_future();
 }
 
+void Actor::init_completed() {
+  if (!m_stream.is_async()) {
+    // Not before, because the init data exchange writes directly to the stream
+    m_stream.start_queue(&m_trial->thread_pool(), m_trial->actor_queue_options(), m_actor_class);
+  }
+
+  m_init_prom.set_value();
+  m_init_completed = true;
+  spdlog::debug("Trial [{}] - Actor [{}] init complete", m_trial->id(), m_name);
+}
+
 std::future<void> Actor::init() {
   SPDLOG_TRACE("Actor::init(): [{}] [{}]", m_trial->id(), m_name);
   return m_init_prom.get_future();
 }
 
-void Actor::dispatch_observation(cogmentAPI::Observation&& observation, bool last) {
+void Actor::dispatch_observation(const std::shared_ptr<SharedActorInput>& observation, bool last) {
   if (last) {
     ActorStream::InputType msg;
     msg.set_state(cogmentAPI::CommunicationState::LAST);
-    write_to_stream(std::move(msg));
+    write_to_stream(msg);
     SPDLOG_DEBUG("Trial [{}] - Actor [{}] 'LAST' sent", m_trial->id(), m_name);
     m_last_sent = true;
   }
 
-  ActorStream::InputType msg;
-  msg.set_state(cogmentAPI::CommunicationState::NORMAL);
-  *(msg.mutable_observation()) = std::move(observation);
-  write_to_stream(std::move(msg));
+  write_to_stream(observation);
 }
 
-void Actor::dispatch_reward(cogmentAPI::Reward&& reward) {
-  ActorStream::InputType msg;
-  msg.set_state(cogmentAPI::CommunicationState::NORMAL);
-  *(msg.mutable_reward()) = std::move(reward);
-  write_to_stream(std::move(msg));
-}
+// One reward per tick (normally only the current tick), in tick order
+void Actor::dispatch_rewards() {
+  auto& acc = m_reward_accumulator;
+  if (acc.tick_ids.empty()) {
+    return;
+  }
 
-void Actor::dispatch_message(cogmentAPI::Message&& message) {
-  ActorStream::InputType msg;
-  msg.set_state(cogmentAPI::CommunicationState::NORMAL);
-  *(msg.mutable_message()) = std::move(message);
-  write_to_stream(std::move(msg));
+  auto& tick_ids = acc.distinct_tick_ids;
+  tick_ids.assign(acc.tick_ids.begin(), acc.tick_ids.end());
+  std::sort(tick_ids.begin(), tick_ids.end());
+  tick_ids.erase(std::unique(tick_ids.begin(), tick_ids.end()), tick_ids.end());
+
+  const size_t nb_rows = acc.tick_ids.size();
+  for (const auto tick_id : tick_ids) {
+    auto arena = m_trial->acquire_arena();
+    auto msg = arena.create<ActorStream::InputType>();
+    msg->set_state(cogmentAPI::CommunicationState::NORMAL);
+
+    auto reward = msg->mutable_reward();
+    for (size_t row = 0; row < nb_rows; row++) {
+      if (acc.tick_ids[row] == tick_id) {
+        *reward->add_sources() = *acc.sources[row];
+      }
+    }
+    reward->set_value(
+        compute_reward_value(acc.tick_ids.data(), acc.values.data(), acc.confidences.data(), nb_rows, tick_id));
+    reward->set_tick_id(tick_id);
+    reward->set_receiver_name(m_name);
+
+    write_to_stream(*msg);
+  }
 }
 
 void Actor::dispatch_init_data() {
@@ -514,7 +912,7 @@ void Actor::dispatch_init_data() {
     init_data->mutable_config()->set_content(m_config_data);
   }
 
-  write_to_stream(std::move(msg));
+  write_to_stream(msg);
 }
 
 void Actor::trial_ended(std::string_view details) {
@@ -540,6 +938,7 @@ void Actor::finish_stream() {
 
   if (!m_finished.exchange(true)) {
     m_finished_prom.set_value();
+    m_trial->actor_dead(m_index);
   }
 }
 
@@ -15,93 +15,261 @@
 #ifndef COGMENT_ORCHESTRATOR_ACTOR_H
 #define COGMENT_ORCHESTRATOR_ACTOR_H
 
+#include "cogment/utils.h"
+
 #include "grpc++/grpc++.h"
 #include "spdlog/spdlog.h"
 
 #include "cogment/api/common.pb.h"
 
+#include "prometheus/counter.h"
+#include "prometheus/family.h"
+#include "prometheus/gauge.h"
+#include "prometheus/summary.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <future>
+#include <vector>
 
 namespace cogment {
 
 class Trial;
 
+// Data sent identically to many actors (e.g. observations).
+// The wire serialization is done only once, when first needed, and shared by all streams.
+class SharedActorInput {
+public:
+  SharedActorInput(cogmentAPI::ActorRunTrialInput&& data) : m_data(std::move(data)) {}
+
+  const cogmentAPI::ActorRunTrialInput& data() const { return m_data; }
+  const grpc::ByteBuffer& serialized();
+
+private:
+  const cogmentAPI::ActorRunTrialInput m_data;
+  std::once_flag m_serialized_once;
+  grpc::ByteBuffer m_serialized;
+};
+
+// Message sent to many actors (e.g. with a wildcard receiver).
+// The content is serialized only once and shared by all streams, only the receiver name is serialized for each actor.
+class SharedActorMessage {
+public:
+  SharedActorMessage(const cogmentAPI::Message& message, uint64_t tick_id);
+
+  // Complete `ActorStream::InputType` message for the receiver
+  void make_input(const std::string& receiver_name, cogmentAPI::ActorRunTrialInput* out) const;
+  grpc::ByteBuffer serialized(const std::string& receiver_name);
+
+private:
+  cogmentAPI::Message m_message;  // Without receiver name
+  std::once_flag m_serialized_once;
+  grpc::Slice m_serialized_state;
+  grpc::Slice m_serialized_message;
+};
+
 // Bare minimum to allow a common stream to represent client and server
 class ActorStream {
 public:
   using InputType = cogmentAPI::ActorRunTrialInput;
   using OutputType = cogmentAPI::ActorRunTrialOutput;
+  using ReadHandler = std::function<void(OutputType&&)>;
+  using DoneHandler = std::function<void()>;
 
   ActorStream() {}
   virtual ~ActorStream() {}
 
   virtual bool read(OutputType* data) = 0;
   virtual bool write(const InputType& data) = 0;
+  virtual bool write(SharedActorInput* data) { return write(data->data()); }
+  virtual bool write(SharedActorMessage* data, const std::string& receiver_name) {
+    InputType input;
+    data->make_input(receiver_name, &input);
+    return write(input);
+  }
   virtual bool write_last(const InputType& data) = 0;
   virtual bool finish() = 0;
+
+  // Holds the writes to send them together (if supported)
+  virtual void cork() {}
+  virtual void uncork() {}
+
+  // Number of writes sent to the network (i.e. not held or buffered)
+  virtual uint64_t nb_flushes() const { return 0; }
+
+  // Asynchronous streams do not support `read`: the incoming data is
+  // given to the read handler, and the done handler is called at the end.
+  virtual bool is_async() const { return false; }
+  virtual void start(ReadHandler&& on_read, DoneHandler&& on_done) {
+    throw MakeException("Synchronous actor streams cannot be started");
+  }
+
+  // After this returns, the handlers will not be called anymore
+  virtual void close() {}
+};
+
+// Writes waiting to be sent on the synchronous stream of an actor
+struct ActorQueueOptions {
+  // Labeled by actor class
+  struct Metrics {
+    prometheus::Family<prometheus::Gauge>* depth = nullptr;
+    prometheus::Family<prometheus::Summary>* write_time = nullptr;
+    prometheus::Family<prometheus::Summary>* lag = nullptr;
+    prometheus::Family<prometheus::Counter>* overflows = nullptr;
+  };
+
+  size_t max_size = 64;  // 0 for no queue (i.e. writes block the caller)
+  Metrics metrics;
 };
 
 // This class is to try to compensate/workaround limitations and bugs in gRPC
 class ManagedStream {
 public:
-  ManagedStream() : m_stream_valid(false), m_last_writen(false) {}
+  ManagedStream() :
+      m_stream_valid(false),
+      m_last_writen(false),
+      m_queued(false),
+      m_queue_pool(nullptr),
+      m_last_queued(false),
+      m_last_held(false),
+      m_overflowed(false),
+      m_draining(false) {}
   void operator=(std::unique_ptr<ActorStream> stream);
 
   ActorStream* actor_stream_ptr() { return m_stream.get(); }
   bool has_stream() const { return (m_stream != nullptr); }
   bool is_valid() const { return m_stream_valid; }
+  bool is_async() const { return (m_stream != nullptr && m_stream->is_async()); }
+  bool has_overflowed() const { return m_overflowed; }
 
+  void start(ActorStream::ReadHandler&& on_read, ActorStream::DoneHandler&& on_done);
   bool read(ActorStream::OutputType* data);
   bool write(const ActorStream::InputType& data);
+  bool write(const std::shared_ptr<SharedActorInput>& data);
+  bool write(SharedActorMessage* data, const std::string& receiver_name);
   bool write_last(const ActorStream::InputType& data);
   void finish();
 
+  // From then on, the writes are queued and sent from the thread pool instead of blocking the caller.
+  // The caller never waits (it may be a completion queue thread): if the queue is full, the stream
+  // becomes invalid (the writes fail) and `has_overflowed` is set, except for the last write which
+  // is held until the queue is empty. Asynchronous streams already queue their writes.
+  void start_queue(ThreadPool* pool, const ActorQueueOptions& options, const std::string& actor_class);
+
+  void cork();
+  void uncork();
+  uint64_t nb_flushes() const { return (m_stream != nullptr) ? m_stream->nb_flushes() : 0; }
+
+  // Destroys the stream. There must be no reading or writing in progress.
+  void close();
+
 private:
+  struct QueuedWrite {
+    ActorStream::InputType data;
+    std::shared_ptr<SharedActorInput> shared_data;
+    bool last = false;
+    uint64_t timestamp = 0;
+  };
+
+  template <class... DataTypes>
+  bool write_data(DataTypes&&... data);
+  bool write_last_data(const ActorStream::InputType& data);
+  template <class FillFunc>
+  bool enqueue(bool last, FillFunc&& fill);
+  void drain_queue();
+  void wait_queue_drained();
+
   std::unique_ptr<ActorStream> m_stream;
   std::mutex m_writing;
   std::mutex m_reading;
   std::atomic_bool m_stream_valid;
   std::atomic_bool m_last_writen;
+
+  std::atomic_bool m_queued;
+  ThreadPool* m_queue_pool;
+  struct QueueMetrics {
+    prometheus::Gauge* depth = nullptr;
+    prometheus::Summary* write_time = nullptr;
+    prometheus::Summary* lag = nullptr;
+    prometheus::Counter* overflows = nullptr;
+  };
+  QueueMetrics m_queue_metrics;
+  std::unique_ptr<RingBuffer<QueuedWrite>> m_queue;
+  std::mutex m_queue_lock;
+  std::condition_variable m_queue_cond;
+  bool m_last_queued;
+  QueuedWrite m_held_last;
+  bool m_last_held;
+  std::atomic_bool m_overflowed;
+  bool m_draining;
 };
 
 class Actor {
   using TickIdType = uint64_t;
-  using RewardAccumulator = std::map<TickIdType, cogmentAPI::Reward>;
+
+  // Reward sources to dispatch, as columns (one row per source)
+  struct RewardAccumulator {
+    std::vector<TickIdType> tick_ids;
+    std::vector<float> values;
+    std::vector<float> confidences;
+    std::vector<const cogmentAPI::RewardSource*> sources;
+    std::vector<TickIdType> distinct_tick_ids;
+
+    void clear() {
+      tick_ids.clear();
+      values.clear();
+      confidences.clear();
+      sources.clear();
+    }
+  };
 
 public:
-  Actor(Trial* owner, const cogmentAPI::ActorParams& params, bool read_init);
+  Actor(Trial* owner, uint32_t index, const cogmentAPI::ActorParams& params, bool read_init);
   virtual ~Actor();
 
   virtual std::future<void> init();
 
   bool has_joined() const { return m_stream.has_stream(); }
-  std::future<void> last_ack() { return m_last_ack_prom.get_future(); }
+  uint64_t nb_flushes() const { return m_stream.nb_flushes(); }
+  OneShotSignal& last_ack() { return m_last_ack; }
 
   Trial* trial() const { return m_trial; }
+  uint32_t actor_index() const { return m_index; }
   const std::string& actor_name() const { return m_name; }
   const std::string& actor_class() const { return m_actor_class; }
 
-  void add_reward_src(const cogmentAPI::RewardSource& source, TickIdType tick_id);
-  void send_message(const cogmentAPI::Message& message, TickIdType tick_id);
+  // Must be called in the same thread as `dispatch_tick`, and the source must be valid until then
+  void add_reward_src(const cogmentAPI::RewardSource* source, TickIdType tick_id);
+  // The receiver name is set to this actor (because of possible wildcards in message receiver)
+  void send_message(SharedActorMessage* message);
 
-  void dispatch_tick(cogmentAPI::Observation&& obs, bool final_tick);
+  // The observation must be a complete `ActorStream::InputType` message
+  void dispatch_tick(const std::shared_ptr<SharedActorInput>& obs, bool final_tick);
   void trial_ended(std::string_view details);
 
 protected:
+  enum class InitDataStatus { waiting, received, ended };
+  static InitDataStatus process_init_data(ActorStream* stream, ActorStream::OutputType&& data,
+                                          cogmentAPI::ActorInitialOutput* out);
   static bool read_init_data(ActorStream* stream, cogmentAPI::ActorInitialOutput* out);
   std::future<void> run(std::unique_ptr<ActorStream> stream);
 
 private:
-  void write_to_stream(ActorStream::InputType&& data);
+  void write_to_stream(const ActorStream::InputType& data);
+  void write_to_stream(const std::shared_ptr<SharedActorInput>& data);
+  void write_to_stream(SharedActorMessage* data);
+  void write_failed();
   void dispatch_init_data();
-  void dispatch_observation(cogmentAPI::Observation&& obs, bool last);
-  void dispatch_reward(cogmentAPI::Reward&& reward);
-  void dispatch_message(cogmentAPI::Message&& message);
+  void dispatch_observation(const std::shared_ptr<SharedActorInput>& obs, bool last);
+  void dispatch_rewards();
   void process_incoming_state(cogmentAPI::CommunicationState in_state, const std::string* details);
   void process_incoming_data(ActorStream::OutputType&& data);
+  void process_incoming(ActorStream::OutputType&& data);
   void process_incoming_stream();
+  void init_completed();
   void finish_stream();
 
   bool m_wait_for_init_data;
@@ -109,13 +277,14 @@ private:
   ManagedStream m_stream;
 
   Trial* const m_trial;
+  const uint32_t m_index;
+  const bool m_tick_bundling;
   const std::string m_name;
   const std::string m_actor_class;
   const std::string m_impl;
   std::string m_config_data;
   bool m_has_config;
 
-  std::mutex m_reward_lock;
   RewardAccumulator m_reward_accumulator;
 
   std::future<void> m_incoming_thread;
@@ -125,10 +294,13 @@ private:
 
   bool m_last_sent;
   bool m_last_ack_received;
-  std::promise<void> m_last_ack_prom;
+  OneShotSignal m_last_ack;
 
   std::promise<void> m_finished_prom;
   std::atomic_bool m_finished;
+
+  std::atomic_bool m_disconnecting;
+  std::future<void> m_disconnect_fut;
 };
 
 }  // namespace cogment
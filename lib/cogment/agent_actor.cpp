@@ -22,22 +22,69 @@
 
 #include "spdlog/spdlog.h"
 
+namespace {
+
+const std::string RUN_TRIAL_METHOD = fmt::format("/{}/RunTrial", cogmentAPI::ServiceActorSP::service_full_name());
+
+}  // namespace
+
 namespace cogment {
 
-ServiceActor::ServiceActor(Trial* owner, const cogmentAPI::ActorParams& params, StubEntryType stub_entry) :
-    Actor(owner, params, true), m_stub_entry(std::move(stub_entry)) {
-  m_context.AddMetadata("trial-id", trial()->id());
+void ClientStream::start(ReadHandler&& on_read, DoneHandler&& on_done) {
+  auto read_handler = [on_read = std::move(on_read)](grpc::ByteBuffer&& buffer) {
+    OutputType data;
+    DeserializeMessage(&buffer, &data);
+    on_read(std::move(data));
+  };
+  auto done_handler = [on_done = std::move(on_done)](const grpc::Status&) {
+    on_done();
+  };
+
+  if (m_call != nullptr) {
+    m_stream->start(std::move(m_call), std::move(read_handler), std::move(done_handler));
+  }
+  else {
+    m_stream->start(std::move(read_handler), std::move(done_handler));
+  }
+}
+
+// Static
+std::shared_ptr<ClientStream::StreamType> ServiceActor::open_stream(ClientEngine* engine,
+                                                                    const StubEntryType& stub_entry,
+                                                                    const std::string& trial_id) {
+  auto stream = ClientStream::StreamType::make(engine);
+  stream->context()->AddMetadata("trial-id", trial_id);
+  stream->open(stub_entry->get_generic_stub().PrepareCall(stream->context(), RUN_TRIAL_METHOD, stream->queue()));
+  return stream;
+}
+
+ServiceActor::ServiceActor(Trial* owner, uint32_t index, const cogmentAPI::ActorParams& params,
+                           StubEntryType stub_entry, std::shared_ptr<ClientStream::StreamType> opened_stream) :
+    Actor(owner, index, params, true), m_stub_entry(std::move(stub_entry)), m_opened_stream(std::move(opened_stream)) {}
+
+ServiceActor::~ServiceActor() {
+  // Not used (i.e. the actor was never initialized)
+  if (m_opened_stream != nullptr) {
+    m_opened_stream->cancel();
+    m_opened_stream->wait_done();
+  }
 }
 
 std::future<void> ServiceActor::init() {
   SPDLOG_TRACE("ServiceActor::init(): [{}] [{}]", trial()->id(), actor_name());
 
-  auto grpc_stream = m_stub_entry->get_stub().RunTrial(&m_context);
-  auto stream = std::make_unique<ClientStream>(std::move(grpc_stream));
+  std::unique_ptr<ClientStream> stream;
+  if (m_opened_stream != nullptr) {
+    stream = std::make_unique<ClientStream>(std::move(m_opened_stream), nullptr, m_stub_entry);
+  }
+  else {
+    auto async_stream = ClientStream::StreamType::make(&trial()->client_engine());
+    async_stream->context()->AddMetadata("trial-id", trial()->id());
+    auto call = m_stub_entry->get_generic_stub().PrepareCall(async_stream->context(), RUN_TRIAL_METHOD,
+                                                            async_stream->queue());
+    stream = std::make_unique<ClientStream>(std::move(async_stream), std::move(call), m_stub_entry);
+  }
 
-  // TODO: The problem here is that this stream will outlive the context. And less importantly
-  //       (because it is kept in the orchestrator) it will outlive the stub entry.
-  //       We could move them in the ClientStream!
   run(std::move(stream));
 
   return Actor::init();
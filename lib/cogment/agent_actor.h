@@ -16,6 +16,7 @@
 #define COGMENT_ORCHESTRATOR_AGENT_ACTOR_H
 
 #include "cogment/actor.h"
+#include "cogment/async_client.h"
 #include "cogment/stub_pool.h"
 
 #include "cogment/api/agent.grpc.pb.h"
@@ -23,24 +24,42 @@
 
 namespace cogment {
 
+// Adapts an asynchronous client call to the actor stream interface.
+// The call is generic (serialized messages) so that shared data can be sent without re-serialization.
 class ClientStream : public ActorStream {
 public:
-  using StreamType = grpc::ClientReaderWriter<InputType, OutputType>;
+  using StreamType = AsyncClientStream<grpc::ByteBuffer, grpc::ByteBuffer>;
+  using StubEntryType = std::shared_ptr<StubPool<cogmentAPI::ServiceActorSP>::Entry>;
+
+  // The call is null if the stream was already opened
+  ClientStream(std::shared_ptr<StreamType> stream, std::unique_ptr<StreamType::CallType> call,
+               StubEntryType stub_entry) :
+      m_stream(std::move(stream)), m_call(std::move(call)), m_stub_entry(std::move(stub_entry)) {}
+  ~ClientStream() { close(); }
 
-  ClientStream(std::unique_ptr<StreamType> stream) : m_stream(std::move(stream)) {}
+  bool is_async() const override { return true; }
+  void start(ReadHandler&& on_read, DoneHandler&& on_done) override;
+  void close() override {
+    m_stream->cancel();
+    m_stream->wait_done();
+  }
 
-  bool read(OutputType* data) override { return m_stream->Read(data); }
-  bool write(const InputType& data) override { return m_stream->Write(data); }
-  bool write_last(const InputType& data) override {
-    if (m_stream->Write(data)) {
-      return m_stream->WritesDone();
-    }
-    return false;
+  bool read(OutputType*) override { return false; }
+  bool write(const InputType& data) override { return m_stream->write(SerializeMessage(data)); }
+  bool write(SharedActorInput* data) override { return m_stream->write(data->serialized()); }
+  bool write(SharedActorMessage* data, const std::string& receiver_name) override {
+    return m_stream->write(data->serialized(receiver_name));
   }
-  bool finish() override { return m_stream->Finish().ok(); }
+  bool write_last(const InputType& data) override { return m_stream->write_last(SerializeMessage(data)); }
+  bool finish() override { return true; }
+  void cork() override { m_stream->cork(); }
+  void uncork() override { m_stream->uncork(); }
+  uint64_t nb_flushes() const override { return m_stream->nb_flushes(); }
 
 private:
-  std::unique_ptr<StreamType> m_stream;
+  std::shared_ptr<StreamType> m_stream;
+  std::unique_ptr<StreamType::CallType> m_call;
+  StubEntryType m_stub_entry;
 };
 
 class Trial;
@@ -49,13 +68,20 @@ class ServiceActor : public Actor {
   using StubEntryType = std::shared_ptr<StubPool<cogmentAPI::ServiceActorSP>::Entry>;
 
 public:
-  ServiceActor(Trial* owner, const cogmentAPI::ActorParams& params, StubEntryType stub_entry);
+  // Opens a stream in advance for a trial (see `opened_stream` of the constructor)
+  static std::shared_ptr<ClientStream::StreamType> open_stream(ClientEngine* engine, const StubEntryType& stub_entry,
+                                                               const std::string& trial_id);
+
+  // If not null, `opened_stream` is used instead of opening a new stream (it must be for the same trial)
+  ServiceActor(Trial* owner, uint32_t index, const cogmentAPI::ActorParams& params, StubEntryType stub_entry,
+               std::shared_ptr<ClientStream::StreamType> opened_stream = nullptr);
+  ~ServiceActor();
 
   std::future<void> init() override;
 
 private:
   StubEntryType m_stub_entry;
-  grpc::ClientContext m_context;
+  std::shared_ptr<ClientStream::StreamType> m_opened_stream;
 };
 
 }  // namespace cogment
@@ -0,0 +1,155 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/arena_pool.h"
+#include "cogment/utils.h"
+
+#include "spdlog/spdlog.h"
+
+namespace {
+
+constexpr size_t MIN_INITIAL_BLOCK_SIZE = 4 * 1024;
+constexpr size_t MAX_INITIAL_BLOCK_SIZE = 4 * 1024 * 1024;
+
+// Heap blocks allocated by arenas in the current thread
+thread_local uint64_t t_nb_heap_blocks = 0;
+
+size_t block_size_for(uint64_t space_used) {
+  size_t size = MIN_INITIAL_BLOCK_SIZE;
+  while (size < space_used && size < MAX_INITIAL_BLOCK_SIZE) {
+    size *= 2;
+  }
+  return size;
+}
+
+}  // namespace
+
+namespace cogment {
+
+struct ArenaPool::Entry {
+  // The arena must be destroyed before its initial block
+  std::unique_ptr<char[]> initial_block;
+  size_t initial_block_size;
+  std::unique_ptr<google::protobuf::Arena> arena;
+};
+
+ArenaPool::Lease::Lease(ArenaPool* pool, std::unique_ptr<Entry>&& entry, std::atomic<uint64_t>* heap_blocks_tally) :
+    m_pool(pool),
+    m_entry(std::move(entry)),
+    m_heap_blocks_tally(heap_blocks_tally),
+    m_start_heap_blocks(t_nb_heap_blocks) {}
+
+ArenaPool::Lease::~Lease() {
+  if (m_entry != nullptr) {
+    const uint64_t nb_heap_blocks = t_nb_heap_blocks - m_start_heap_blocks;
+    if (m_heap_blocks_tally != nullptr) {
+      *m_heap_blocks_tally += nb_heap_blocks;
+    }
+    m_pool->release(std::move(m_entry), nb_heap_blocks);
+  }
+}
+
+google::protobuf::Arena* ArenaPool::Lease::get() {
+  if (m_entry == nullptr) {
+    throw MakeException("Arena lease was moved");
+  }
+  return m_entry->arena.get();
+}
+
+ArenaPool::ArenaPool(const Metrics& met) : m_metrics(met) { SPDLOG_TRACE("ArenaPool()"); }
+
+ArenaPool::~ArenaPool() {
+  SPDLOG_TRACE("~ArenaPool(): [{}] arenas", m_free_entries.size());
+}
+
+// Static
+void* ArenaPool::block_alloc(size_t size) {
+  t_nb_heap_blocks++;
+  return ::operator new(size);
+}
+
+// Static
+void ArenaPool::block_dealloc(void* block, size_t size) { ::operator delete(block); }
+
+// Static
+std::unique_ptr<ArenaPool::Entry> ArenaPool::make_entry(size_t initial_block_size) {
+  auto entry = std::make_unique<Entry>();
+  entry->initial_block = std::make_unique<char[]>(initial_block_size);
+  entry->initial_block_size = initial_block_size;
+
+  google::protobuf::ArenaOptions options;
+  options.initial_block = entry->initial_block.get();
+  options.initial_block_size = initial_block_size;
+  options.block_alloc = &ArenaPool::block_alloc;
+  options.block_dealloc = &ArenaPool::block_dealloc;
+  entry->arena = std::make_unique<google::protobuf::Arena>(options);
+
+  return entry;
+}
+
+ArenaPool::Lease ArenaPool::acquire(std::atomic<uint64_t>* heap_blocks_tally) {
+  std::unique_ptr<Entry> entry;
+  {
+    const std::lock_guard lg(m_lock);
+    if (!m_free_entries.empty()) {
+      entry = std::move(m_free_entries.back());
+      m_free_entries.pop_back();
+    }
+  }
+
+  if (entry == nullptr) {
+    entry = make_entry(MIN_INITIAL_BLOCK_SIZE);
+  }
+
+  if (m_metrics.leases != nullptr) {
+    m_metrics.leases->Increment();
+  }
+
+  return Lease(this, std::move(entry), heap_blocks_tally);
+}
+
+void ArenaPool::release(std::unique_ptr<Entry>&& entry, uint64_t nb_heap_blocks) {
+  if (m_metrics.heap_blocks != nullptr && nb_heap_blocks > 0) {
+    m_metrics.heap_blocks->Increment(static_cast<double>(nb_heap_blocks));
+  }
+
+  try {
+    const uint64_t space_used = entry->arena->Reset();
+
+    // If the initial block was too small, it is replaced so the next use fits in it
+    if (space_used > entry->initial_block_size && entry->initial_block_size < MAX_INITIAL_BLOCK_SIZE) {
+      const size_t new_size = block_size_for(space_used);
+      entry->arena.reset();
+      entry = make_entry(new_size);
+      SPDLOG_TRACE("Arena initial block increased to [{}] bytes", new_size);
+    }
+  }
+  catch (const std::exception& exc) {
+    spdlog::error("Failed to recycle arena [{}]", exc.what());
+    return;
+  }
+  catch (...) {
+    spdlog::error("Failed to recycle arena");
+    return;
+  }
+
+  const std::lock_guard lg(m_lock);
+  m_free_entries.emplace_back(std::move(entry));
+}
+
+}  // namespace cogment
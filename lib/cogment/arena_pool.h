@@ -0,0 +1,90 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_ARENA_POOL_H
+#define COGMENT_ORCHESTRATOR_ARENA_POOL_H
+
+#include "google/protobuf/arena.h"
+#include "prometheus/counter.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cogment {
+
+// Pool of protobuf arenas for short lived messages (e.g. built and sent during a tick).
+// Each arena has an initial block that is kept when the arena is returned to the pool,
+// and that grows to fit the usage. So in steady state, messages built on a pooled arena
+// do not allocate from the heap.
+class ArenaPool {
+  struct Entry;
+
+public:
+  struct Metrics {
+    prometheus::Counter* leases = nullptr;
+    prometheus::Counter* heap_blocks = nullptr;
+  };
+
+  // Exclusive use of an arena until destruction.
+  // A lease must be used and destroyed in the same thread.
+  class Lease {
+  public:
+    Lease(ArenaPool* pool, std::unique_ptr<Entry>&& entry, std::atomic<uint64_t>* heap_blocks_tally);
+    ~Lease();
+
+    Lease(Lease&&) = default;
+    Lease(const Lease&) = delete;
+    void operator=(const Lease&) = delete;
+    void operator=(Lease&&) = delete;
+
+    google::protobuf::Arena* get();
+
+    template <class T>
+    T* create() {
+      return google::protobuf::Arena::CreateMessage<T>(get());
+    }
+
+  private:
+    ArenaPool* m_pool;
+    std::unique_ptr<Entry> m_entry;
+    std::atomic<uint64_t>* m_heap_blocks_tally;
+    uint64_t m_start_heap_blocks;
+  };
+
+  ArenaPool(const Metrics& met);
+  ~ArenaPool();
+
+  ArenaPool(const ArenaPool&) = delete;
+  ArenaPool(ArenaPool&&) = delete;
+  void operator=(const ArenaPool&) = delete;
+  void operator=(ArenaPool&&) = delete;
+
+  // The number of heap blocks allocated during the lease is added to the tally (if not null)
+  Lease acquire(std::atomic<uint64_t>* heap_blocks_tally = nullptr);
+
+private:
+  static void* block_alloc(size_t size);
+  static void block_dealloc(void* block, size_t size);
+  static std::unique_ptr<Entry> make_entry(size_t initial_block_size);
+  void release(std::unique_ptr<Entry>&& entry, uint64_t nb_heap_blocks);
+
+  Metrics m_metrics;
+  std::mutex m_lock;
+  std::vector<std::unique_ptr<Entry>> m_free_entries;
+};
+
+}  // namespace cogment
+#endif
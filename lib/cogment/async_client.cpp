@@ -0,0 +1,75 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/async_client.h"
+
+#include "spdlog/spdlog.h"
+
+namespace cogment {
+
+ClientEngine::ClientEngine(size_t nb_threads) : m_next_queue(0) {
+  if (nb_threads == 0) {
+    nb_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  spdlog::debug("Asynchronous client engine using [{}] threads", nb_threads);
+
+  m_queues.reserve(nb_threads);
+  m_threads.reserve(nb_threads);
+  for (size_t index = 0; index < nb_threads; index++) {
+    auto queue = m_queues.emplace_back(std::make_unique<grpc::CompletionQueue>()).get();
+    m_threads.emplace_back(&ClientEngine::poll, queue);
+  }
+}
+
+ClientEngine::~ClientEngine() {
+  SPDLOG_TRACE("~ClientEngine()");
+
+  for (auto& queue : m_queues) {
+    queue->Shutdown();
+  }
+  for (auto& thr : m_threads) {
+    thr.join();
+  }
+}
+
+grpc::CompletionQueue* ClientEngine::next_queue() {
+  const size_t index = m_next_queue++ % m_queues.size();
+  return m_queues[index].get();
+}
+
+// Static
+void ClientEngine::poll(grpc::CompletionQueue* queue) {
+  void* tag = nullptr;
+  bool ok = false;
+
+  while (queue->Next(&tag, &ok)) {
+    try {
+      static_cast<Operation*>(tag)->completed(ok);
+    }
+    catch (const std::exception& exc) {
+      spdlog::error("Asynchronous client operation failed [{}]", exc.what());
+    }
+    catch (...) {
+      spdlog::error("Asynchronous client operation failed");
+    }
+  }
+
+  spdlog::debug("Asynchronous client engine thread exiting");
+}
+
+}  // namespace cogment
@@ -0,0 +1,584 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_ASYNC_CLIENT_H
+#define COGMENT_ORCHESTRATOR_ASYNC_CLIENT_H
+
+#include "cogment/utils.h"
+
+#include "grpc++/grpc++.h"
+#include "grpcpp/impl/codegen/proto_utils.h"
+#include "grpcpp/support/async_stream.h"
+#include "spdlog/spdlog.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cogment {
+
+// For generic calls (i.e. using pre-serialized messages)
+template <class MessageType>
+grpc::ByteBuffer SerializeMessage(const MessageType& msg) {
+  grpc::ByteBuffer buffer;
+  bool own_buffer = false;
+  auto status = grpc::SerializationTraits<MessageType>::Serialize(msg, &buffer, &own_buffer);
+  if (!status.ok()) {
+    throw MakeException("Failed to serialize message [{}]", status.error_message());
+  }
+  return buffer;
+}
+
+template <class MessageType>
+void DeserializeMessage(grpc::ByteBuffer* buffer, MessageType* msg) {
+  auto status = grpc::SerializationTraits<MessageType>::Deserialize(buffer, msg);
+  if (!status.ok()) {
+    throw MakeException("Failed to deserialize message [{}]", status.error_message());
+  }
+}
+
+// Fixed set of threads polling the completion queues of all the asynchronous
+// gRPC client calls made by the Orchestrator (environments, service actors, datalogs).
+// This replaces the thread per stream that was needed with the synchronous API.
+class ClientEngine {
+public:
+  // All tags given to the completion queues must be of this type
+  class Operation {
+  public:
+    virtual ~Operation() {}
+    virtual void completed(bool ok) = 0;
+  };
+
+  // If nb_threads is 0, the number of hardware cores is used
+  ClientEngine(size_t nb_threads);
+  ~ClientEngine();
+
+  ClientEngine(const ClientEngine&) = delete;
+  ClientEngine(ClientEngine&&) = delete;
+  void operator=(const ClientEngine&) = delete;
+  void operator=(ClientEngine&&) = delete;
+
+  // Queues are distributed in a round-robin fashion
+  grpc::CompletionQueue* next_queue();
+
+private:
+  static void poll(grpc::CompletionQueue* queue);
+
+  std::vector<std::unique_ptr<grpc::CompletionQueue>> m_queues;
+  std::vector<std::thread> m_threads;
+  std::atomic<size_t> m_next_queue;
+};
+
+// Bidirectional streaming client call driven by the ClientEngine.
+// Incoming data is delivered to the read handler (from an engine thread) as it arrives,
+// and writes are queued and sent in order without blocking the caller.
+// The object keeps itself alive until the call is complete.
+template <class InputType, class OutputType>
+class AsyncClientStream : public std::enable_shared_from_this<AsyncClientStream<InputType, OutputType>> {
+public:
+  using CallType = grpc::ClientAsyncReaderWriter<InputType, OutputType>;
+  using ReadHandler = std::function<void(OutputType&&)>;
+  using DoneHandler = std::function<void(const grpc::Status&)>;
+  using WrittenHandler = std::function<void()>;
+
+  static std::shared_ptr<AsyncClientStream> make(ClientEngine* engine) {
+    return std::shared_ptr<AsyncClientStream>(new AsyncClientStream(engine->next_queue()));
+  }
+
+  AsyncClientStream(const AsyncClientStream&) = delete;
+  AsyncClientStream(AsyncClientStream&&) = delete;
+  void operator=(const AsyncClientStream&) = delete;
+  void operator=(AsyncClientStream&&) = delete;
+
+  // The context and queue must be used to prepare the call (e.g. `Stub::PrepareAsyncRunTrial`)
+  grpc::ClientContext* context() { return &m_context; }
+  grpc::CompletionQueue* queue() { return m_queue; }
+
+  void start(std::unique_ptr<CallType> call, ReadHandler&& on_read, DoneHandler&& on_done) {
+    const std::lock_guard lg(m_lock);
+
+    m_on_read = std::move(on_read);
+    m_on_done = std::move(on_done);
+    m_reading = true;
+    start_call(std::move(call));
+  }
+
+  // Starts the call without reading from it (e.g. to have it ready in advance).
+  // Writes are sent, but nothing is read until `start` is called.
+  void open(std::unique_ptr<CallType> call) {
+    const std::lock_guard lg(m_lock);
+    start_call(std::move(call));
+  }
+
+  // Starts reading from a stream that was opened
+  void start(ReadHandler&& on_read, DoneHandler&& on_done) {
+    std::unique_lock ul(m_lock);
+
+    if (m_call == nullptr) {
+      throw MakeException("Asynchronous stream must be opened before starting");
+    }
+    if (m_reading) {
+      throw MakeException("Asynchronous stream already started");
+    }
+    m_reading = true;
+
+    if (m_done) {
+      // The call finished while only opened
+      ul.unlock();
+      on_done(m_status);
+      return;
+    }
+
+    m_on_read = std::move(on_read);
+    m_on_done = std::move(on_done);
+    if (m_call_ready && !m_finishing) {
+      m_nb_pending_ops++;
+      m_call->Read(&m_read_data, &m_read_op);
+    }
+  }
+
+  // Called (from an engine thread) after each successful write, but not after the writes done.
+  // Must be set before `start`.
+  void set_written_handler(WrittenHandler&& on_written) { m_on_written = std::move(on_written); }
+
+  bool is_valid() const { return m_valid; }
+
+  // Returns false if the stream cannot be written to anymore
+  bool write(InputType&& data) { return queue_write(std::move(data), false, false); }
+  bool write(const InputType& data) { return queue_write(InputType(data), false, false); }
+
+  // gRPC may hold the data to send it with the following writes
+  bool write_buffered(InputType&& data) { return queue_write(std::move(data), false, true); }
+
+  // Indicates that no more data will be written after this (the held writes are released)
+  bool write_last(InputType&& data) { return queue_write(std::move(data), true, false); }
+
+  // While corked, the writes are held. They are released together when uncorked, with a hint
+  // to gRPC to send them at once (only the last write flushes to the network).
+  void cork() {
+    const std::lock_guard lg(m_lock);
+    m_corked = true;
+  }
+  void uncork() {
+    const std::lock_guard lg(m_lock);
+    release_corked_writes();
+  }
+
+  // Number of writes that were not buffered (i.e. that flush the data to the network)
+  uint64_t nb_flushes() const { return m_nb_flushes; }
+
+  void writes_done() {
+    const std::lock_guard lg(m_lock);
+    if (!m_writes_closed) {
+      m_writes_closed = true;
+      m_writes_done_requested = true;
+      pump_writes();
+    }
+  }
+
+  // The call will complete promptly (with a cancelled status) after this
+  void cancel() {
+    m_context.TryCancel();
+
+    // Nothing else would finish a stream that was only opened
+    const std::lock_guard lg(m_lock);
+    if (m_started && !m_reading) {
+      finish_call();
+    }
+  }
+
+  // After this returns, the handlers will not be called anymore
+  void wait_done() {
+    if (m_started) {
+      m_done_fut.wait();
+    }
+  }
+
+private:
+  class Operation : public ClientEngine::Operation {
+  public:
+    using Handler = void (AsyncClientStream::*)(bool);
+    Operation(AsyncClientStream* owner, Handler handler) : m_owner(owner), m_handler(handler) {}
+
+    void completed(bool ok) override {
+      // The owner may release itself in the handler
+      auto keep_alive = m_owner->shared_from_this();
+      (m_owner->*m_handler)(ok);
+    }
+
+  private:
+    AsyncClientStream* const m_owner;
+    const Handler m_handler;
+  };
+
+  struct WriteEntry {
+    InputType data;
+    bool last;
+    bool buffered;
+  };
+
+  AsyncClientStream(grpc::CompletionQueue* queue) :
+      m_queue(queue),
+      m_start_op(this, &AsyncClientStream::on_started),
+      m_read_op(this, &AsyncClientStream::on_read),
+      m_write_op(this, &AsyncClientStream::on_written),
+      m_finish_op(this, &AsyncClientStream::on_finished),
+      m_valid(true),
+      m_started(false),
+      m_reading(false),
+      m_call_ready(false),
+      m_write_pending(false),
+      m_writes_closed(false),
+      m_writes_done_requested(false),
+      m_writes_done_pending(false),
+      m_finishing(false),
+      m_done(false),
+      m_corked(false),
+      m_nb_pending_ops(0),
+      m_nb_flushes(0) {
+    m_done_fut = m_done_prom.get_future();
+  }
+
+  // Must be called with m_lock held
+  void start_call(std::unique_ptr<CallType> call) {
+    if (m_call != nullptr) {
+      throw MakeException("Asynchronous stream already started");
+    }
+    if (call == nullptr) {
+      throw MakeException("Asynchronous stream started without a call");
+    }
+
+    m_call = std::move(call);
+    m_self = this->shared_from_this();
+    m_started = true;
+
+    m_nb_pending_ops++;
+    m_call->StartCall(&m_start_op);
+  }
+
+  bool queue_write(InputType&& data, bool last, bool buffered) {
+    const std::lock_guard lg(m_lock);
+
+    if (!m_valid) {
+      return false;
+    }
+    if (m_writes_closed) {
+      spdlog::warn("Trying to write to asynchronous stream after last write");
+      return m_valid;
+    }
+
+    m_write_queue.push_back({std::move(data), last, buffered});
+    if (last) {
+      m_writes_closed = true;
+      release_corked_writes();
+    }
+    else {
+      pump_writes();
+    }
+
+    return true;
+  }
+
+  // Must be called with m_lock held
+  void release_corked_writes() {
+    if (!m_corked) {
+      return;
+    }
+    m_corked = false;
+
+    if (!m_write_queue.empty()) {
+      for (size_t index = 0; index < m_write_queue.size() - 1; index++) {
+        m_write_queue[index].buffered = true;
+      }
+    }
+    pump_writes();
+  }
+
+  // Must be called with m_lock held
+  void pump_writes() {
+    if (!m_call_ready || m_write_pending || !m_valid || m_corked) {
+      return;
+    }
+
+    if (!m_write_queue.empty()) {
+      m_current_write = std::move(m_write_queue.front());
+      m_write_queue.pop_front();
+
+      m_write_pending = true;
+      m_nb_pending_ops++;
+      grpc::WriteOptions options;
+      if (m_current_write.last) {
+        options.set_last_message();
+      }
+      else if (m_current_write.buffered) {
+        options.set_buffer_hint();
+      }
+      if (!m_current_write.buffered) {
+        m_nb_flushes++;
+      }
+      m_call->Write(m_current_write.data, options, &m_write_op);
+    }
+    else if (m_writes_done_requested) {
+      m_writes_done_requested = false;
+      m_writes_done_pending = true;
+      m_write_pending = true;
+      m_nb_pending_ops++;
+      m_call->WritesDone(&m_write_op);
+    }
+  }
+
+  // Must be called with m_lock held
+  void finish_call() {
+    m_valid = false;
+    m_write_queue.clear();
+
+    if (!m_finishing) {
+      m_finishing = true;
+      m_nb_pending_ops++;
+      m_call->Finish(&m_status, &m_finish_op);
+    }
+  }
+
+  // Must be called with m_lock held
+  void op_completed() {
+    m_nb_pending_ops--;
+    if (m_nb_pending_ops == 0 && m_finishing && m_done) {
+      m_self.reset();
+    }
+  }
+
+  void on_started(bool ok) {
+    const std::lock_guard lg(m_lock);
+    m_call_ready = true;
+
+    if (ok) {
+      if (m_reading) {
+        m_nb_pending_ops++;
+        m_call->Read(&m_read_data, &m_read_op);
+      }
+      pump_writes();
+    }
+    else {
+      finish_call();
+    }
+
+    op_completed();
+  }
+
+  void on_read(bool ok) {
+    if (ok) {
+      try {
+        m_on_read(std::move(m_read_data));
+      }
+      catch (const std::exception& exc) {
+        spdlog::error("Asynchronous stream read handler failed [{}]", exc.what());
+      }
+      catch (...) {
+        spdlog::error("Asynchronous stream read handler failed");
+      }
+      m_read_data.Clear();
+    }
+
+    const std::lock_guard lg(m_lock);
+    if (ok) {
+      m_nb_pending_ops++;
+      m_call->Read(&m_read_data, &m_read_op);
+    }
+    else {
+      finish_call();
+    }
+
+    op_completed();
+  }
+
+  void on_written(bool ok) {
+    std::unique_lock ul(m_lock);
+    m_write_pending = false;
+    const bool data_written = !m_writes_done_pending;
+    m_writes_done_pending = false;
+
+    if (ok) {
+      pump_writes();
+    }
+    else {
+      // The call is dead, the reads will fail and finish the call
+      m_valid = false;
+      m_write_queue.clear();
+    }
+
+    // The handler may write, so it is called without the lock.
+    // It is still safe since the operation is not completed yet.
+    if (ok && data_written && m_on_written) {
+      ul.unlock();
+      try {
+        m_on_written();
+      }
+      catch (const std::exception& exc) {
+        spdlog::error("Asynchronous stream written handler failed [{}]", exc.what());
+      }
+      catch (...) {
+        spdlog::error("Asynchronous stream written handler failed");
+      }
+      ul.lock();
+    }
+
+    op_completed();
+  }
+
+  void on_finished(bool) {
+    if (!m_status.ok() && m_status.error_code() != grpc::StatusCode::CANCELLED) {
+      spdlog::debug("Asynchronous stream finished with error [{}] [{}]", static_cast<int>(m_status.error_code()),
+                    m_status.error_message());
+    }
+
+    // If the stream was only opened, there is no handler yet and `start` will call it
+    std::unique_lock ul(m_lock);
+    m_done = true;
+    auto on_done = std::move(m_on_done);
+    m_on_done = nullptr;
+    ul.unlock();
+
+    try {
+      if (on_done) {
+        on_done(m_status);
+      }
+    }
+    catch (const std::exception& exc) {
+      spdlog::error("Asynchronous stream done handler failed [{}]", exc.what());
+    }
+    catch (...) {
+      spdlog::error("Asynchronous stream done handler failed");
+    }
+
+    ul.lock();
+    m_on_read = nullptr;
+    m_on_written = nullptr;
+    m_done_prom.set_value();
+
+    op_completed();
+  }
+
+  grpc::ClientContext m_context;
+  grpc::CompletionQueue* const m_queue;
+  std::unique_ptr<CallType> m_call;
+  ReadHandler m_on_read;
+  DoneHandler m_on_done;
+  WrittenHandler m_on_written;
+  std::shared_ptr<AsyncClientStream> m_self;
+
+  Operation m_start_op;
+  Operation m_read_op;
+  Operation m_write_op;
+  Operation m_finish_op;
+
+  std::mutex m_lock;
+  std::atomic_bool m_valid;
+  std::atomic_bool m_started;
+  bool m_reading;
+  bool m_call_ready;
+  bool m_write_pending;
+  bool m_writes_closed;
+  bool m_writes_done_requested;
+  bool m_writes_done_pending;
+  bool m_finishing;
+  bool m_done;
+  bool m_corked;
+  size_t m_nb_pending_ops;
+  std::atomic<uint64_t> m_nb_flushes;
+
+  OutputType m_read_data;
+  WriteEntry m_current_write;
+  std::deque<WriteEntry> m_write_queue;
+
+  grpc::Status m_status;
+  std::promise<void> m_done_prom;
+  std::shared_future<void> m_done_fut;
+};
+
+// Unary client call driven by the ClientEngine.
+// The done handler is called (from an engine thread) with the final status and the reply.
+// The object keeps itself alive until the call is complete.
+template <class ReplyType>
+class AsyncUnaryCall : public ClientEngine::Operation, public std::enable_shared_from_this<AsyncUnaryCall<ReplyType>> {
+public:
+  using CallType = grpc::ClientAsyncResponseReader<ReplyType>;
+  using DoneHandler = std::function<void(const grpc::Status&, ReplyType&&)>;
+
+  static std::shared_ptr<AsyncUnaryCall> make(ClientEngine* engine) {
+    return std::shared_ptr<AsyncUnaryCall>(new AsyncUnaryCall(engine->next_queue()));
+  }
+
+  AsyncUnaryCall(const AsyncUnaryCall&) = delete;
+  AsyncUnaryCall(AsyncUnaryCall&&) = delete;
+  void operator=(const AsyncUnaryCall&) = delete;
+  void operator=(AsyncUnaryCall&&) = delete;
+
+  // The context and queue must be used to prepare the call (e.g. `Stub::PrepareAsyncOnPreTrial`)
+  grpc::ClientContext* context() { return &m_context; }
+  grpc::CompletionQueue* queue() { return m_queue; }
+
+  void start(std::unique_ptr<CallType> call, DoneHandler&& on_done) {
+    if (m_call != nullptr) {
+      throw MakeException("Asynchronous call already started");
+    }
+    if (call == nullptr) {
+      throw MakeException("Asynchronous call started without a call");
+    }
+
+    m_call = std::move(call);
+    m_on_done = std::move(on_done);
+    m_self = this->shared_from_this();
+
+    m_call->StartCall();
+    m_call->Finish(&m_reply, &m_status, this);
+  }
+
+  // The call will complete promptly (with a cancelled status) after this
+  void cancel() { m_context.TryCancel(); }
+
+  void completed(bool) override {
+    auto keep_alive = std::move(m_self);
+
+    try {
+      m_on_done(m_status, std::move(m_reply));
+    }
+    catch (const std::exception& exc) {
+      spdlog::error("Asynchronous call done handler failed [{}]", exc.what());
+    }
+    catch (...) {
+      spdlog::error("Asynchronous call done handler failed");
+    }
+    m_on_done = nullptr;
+  }
+
+private:
+  AsyncUnaryCall(grpc::CompletionQueue* queue) : m_queue(queue) {}
+
+  grpc::ClientContext m_context;
+  grpc::CompletionQueue* const m_queue;
+  std::unique_ptr<CallType> m_call;
+  DoneHandler m_on_done;
+  std::shared_ptr<AsyncUnaryCall> m_self;
+
+  ReplyType m_reply;
+  grpc::Status m_status;
+};
+
+}  // namespace cogment
+#endif
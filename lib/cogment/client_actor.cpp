@@ -71,6 +71,7 @@ void ClientActor::run_an_actor(std::shared_ptr<Trial>&& trial_requested, ServerS
   }
 }
 
-ClientActor::ClientActor(Trial* owner, const cogmentAPI::ActorParams& params) : Actor(owner, params, false) {}
+ClientActor::ClientActor(Trial* owner, uint32_t index, const cogmentAPI::ActorParams& params) :
+    Actor(owner, index, params, false) {}
 
 }  // namespace cogment
\ No newline at end of file
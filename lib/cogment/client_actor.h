@@ -27,25 +27,32 @@ public:
 
   ServerStream(StreamType* stream) : m_stream(stream) {}
 
+  using ActorStream::write;
   bool read(OutputType* data) override { return m_stream->Read(data); }
-  bool write(const InputType& data) override { return m_stream->Write(data); }
+  bool write(const InputType& data) override {
+    m_nb_flushes++;
+    return m_stream->Write(data);
+  }
   bool write_last(const InputType& data) override {
     // We could decide to do nothing special here!
     grpc::WriteOptions options;
     options.set_last_message();
+    m_nb_flushes++;
     return m_stream->Write(data, options);
   }
   bool finish() override { return true; }
+  uint64_t nb_flushes() const override { return m_nb_flushes; }
 
 private:
   StreamType* m_stream;
+  std::atomic<uint64_t> m_nb_flushes {0};
 };
 
 class Trial;
 
 class ClientActor : public Actor {
 public:
-  ClientActor(Trial* owner, const cogmentAPI::ActorParams& params);
+  ClientActor(Trial* owner, uint32_t index, const cogmentAPI::ActorParams& params);
 
   static void run_an_actor(std::shared_ptr<Trial>&& trial_requested, ServerStream::StreamType* stream);
 };
@@ -20,6 +20,12 @@
 
 #include "spdlog/spdlog.h"
 
+#include <zlib.h>
+#include <time.h>
+
+#include <cstring>
+#include <filesystem>
+
 namespace cogment {
 namespace {
 
@@ -31,105 +37,554 @@ constexpr size_t INFO_FIELD = 4;
 
 constexpr size_t NB_FIELDS = 5;
 
-}  // namespace
+const std::string RUN_TRIAL_DATALOG_METHOD =
+    fmt::format("/{}/RunTrialDatalog", cogmentAPI::DatalogSP::service_full_name());
 
-DatalogServiceImpl::DatalogServiceImpl(StubEntryType stub_entry) :
-    m_stub_entry(std::move(stub_entry)), m_stream_valid(false) {
-  SPDLOG_TRACE("DatalogServiceImpl");
+const std::string FILE_SCHEME("file://");
+constexpr uint64_t DEFAULT_MAX_FILE_SIZE = 256 * 1024 * 1024;
+constexpr size_t FILE_WRITE_SIZE = 256 * 1024;
+
+double thread_cpu_seconds() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1) {
+    return 0.0;
+  }
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * NANOS_INV;
 }
 
-DatalogServiceImpl::~DatalogServiceImpl() {
-  SPDLOG_TRACE("~DatalogServiceImpl()");
+std::unique_ptr<ObservationDeltaEncoder> make_delta_encoder(const std::string& name, const std::string& value) {
+  unsigned long interval;
+  try {
+    interval = std::stoul(value);
+  }
+  catch (const std::logic_error&) {
+    throw MakeException("Invalid value for datalog url parameter [{}]: [{}]", name, value);
+  }
 
-  if (m_stream_valid) {
-    m_stream_valid = false;
-    m_stream->WritesDone();
-    m_stream->Finish();
+  if (interval == 0) {
+    return nullptr;
   }
+  return std::make_unique<ObservationDeltaEncoder>(static_cast<uint32_t>(interval));
 }
 
-void DatalogServiceImpl::start(const std::string& trial_id, const std::string& user_id,
-                               const cogmentAPI::TrialParams& params) {
-  if (m_stream != nullptr) {
-    throw MakeException("DatalogService already started for [{}] cannot start for [{}]", m_trial_id, trial_id);
-  }
-  m_trial_id = trial_id;
+}  // namespace
 
+// Static
+DatalogService::FieldSet DatalogService::parse_exclude_fields(const std::string& trial_id,
+                                                              const cogmentAPI::TrialParams& params) {
   static_assert(NB_BITS >= NB_FIELDS);
+  FieldSet result;
+
   const auto& exclude = params.datalog().exclude_fields();
   for (auto field : exclude) {
     std::transform(field.begin(), field.end(), field.begin(), ::tolower);
 
     if (field == "observations") {
-      m_exclude_fields.set(OBSERVATIONS_FIELD);
+      result.set(OBSERVATIONS_FIELD);
     }
     else if (field == "actions") {
-      m_exclude_fields.set(ACTIONS_FIELD);
+      result.set(ACTIONS_FIELD);
     }
     else if (field == "rewards") {
-      m_exclude_fields.set(REWARDS_FIELD);
+      result.set(REWARDS_FIELD);
     }
     else if (field == "messages") {
-      m_exclude_fields.set(MESSAGES_FIELD);
+      result.set(MESSAGES_FIELD);
     }
     else if (field == "info") {
-      m_exclude_fields.set(INFO_FIELD);
+      result.set(INFO_FIELD);
     }
     else {
-      spdlog::warn("Trial [{}] - Datalog excluded field [{}] is not a sample log field", m_trial_id, field);
+      spdlog::warn("Trial [{}] - Datalog excluded field [{}] is not a sample log field", trial_id, field);
     }
   }
-  spdlog::debug("Trial [{}] - Datalog excluded field [{}]", m_trial_id, m_exclude_fields.to_string());
+  spdlog::debug("Trial [{}] - Datalog excluded field [{}]", trial_id, result.to_string());
+
+  return result;
+}
 
-  m_context.AddMetadata("trial-id", m_trial_id);
-  m_context.AddMetadata("user-id", user_id);
-  m_stream = m_stub_entry->get_stub().RunTrialDatalog(&m_context);
+// Static
+void DatalogService::clear_fields(const FieldSet& fields, cogmentAPI::DatalogSample* sample) {
+  if (fields.none()) {
+    return;
+  }
 
-  if (m_stream != nullptr) {
-    cogmentAPI::RunTrialDatalogInput msg;
-    *msg.mutable_trial_params() = params;
-    m_stream_valid = m_stream->Write(msg);
+  if (fields[OBSERVATIONS_FIELD]) {
+    sample->clear_observations();
+  }
+  if (fields[ACTIONS_FIELD]) {
+    sample->clear_actions();
+  }
+  if (fields[REWARDS_FIELD]) {
+    sample->clear_rewards();
+  }
+  if (fields[MESSAGES_FIELD]) {
+    sample->clear_messages();
+  }
+  if (fields[INFO_FIELD]) {
+    sample->clear_info();
   }
 }
 
-void DatalogServiceImpl::dispatch_sample(cogmentAPI::DatalogSample&& data) {
-  if (m_stream_valid) {
-    cogmentAPI::RunTrialDatalogInput msg;
-    *msg.mutable_sample() = std::move(data);
-    m_stream_valid = m_stream->Write(msg);
+// Sends the queued samples to the stream in batches, as the previous batch is written.
+// It is shared with the stream handlers, so it can outlive the service.
+class DatalogServiceImpl::Writer {
+public:
+  Writer(std::shared_ptr<StreamType> stream, const DatalogQueue::Options& queue_options, size_t batch_size,
+         const std::string& trial_id) :
+      m_stream(std::move(stream)),
+      m_queue(queue_options, trial_id),
+      m_batch_size(std::max<size_t>(batch_size, 1)),
+      m_nb_in_flight(0),
+      m_closing(false),
+      m_writes_done(false) {}
+
+  void write(const cogmentAPI::RunTrialDatalogInput& msg) {
+    const std::lock_guard lg(m_lock);
+    if (m_stream->write(SerializeMessage(msg))) {
+      m_nb_in_flight++;
+    }
+  }
+
+  void push(cogmentAPI::DatalogSample* sample) {
+    m_queue.push(sample);
+
+    const std::lock_guard lg(m_lock);
+    pump();
+  }
+
+  void written() {
+    const std::lock_guard lg(m_lock);
+    m_nb_in_flight--;
+    pump();
+  }
+
+  // Remaining samples will be sent before the stream is closed
+  void close() {
+    const std::lock_guard lg(m_lock);
+    m_closing = true;
+    pump();
+  }
+
+  void stream_done() {
+    m_queue.close();
+    const std::lock_guard lg(m_lock);
+    m_writes_done = true;
+  }
+
+private:
+  // Must be called with m_lock held
+  void pump() {
+    if (m_nb_in_flight > 0 || m_writes_done) {
+      return;
+    }
+
+    // The batch is sent with buffer hints (except the last) so gRPC can send it at once
+    grpc::ByteBuffer buffer;
+    grpc::ByteBuffer next_buffer;
+    bool has_data = m_queue.pop(&buffer);
+    while (has_data) {
+      has_data = (m_nb_in_flight + 1 < m_batch_size && m_queue.pop(&next_buffer));
+
+      bool success;
+      if (has_data) {
+        success = m_stream->write_buffered(std::move(buffer));
+        buffer = std::move(next_buffer);
+      }
+      else {
+        success = m_stream->write(std::move(buffer));
+      }
+      if (!success) {
+        return;
+      }
+      m_nb_in_flight++;
+    }
+
+    if (m_nb_in_flight == 0 && m_closing && m_queue.empty()) {
+      m_writes_done = true;
+      m_stream->writes_done();
+    }
   }
-  else {
-    if (m_stream != nullptr) {
-      throw MakeException("DatalogService stream stopped");
+
+  std::shared_ptr<StreamType> m_stream;
+  DatalogQueue m_queue;
+  const size_t m_batch_size;
+
+  std::mutex m_lock;
+  size_t m_nb_in_flight;
+  bool m_closing;
+  bool m_writes_done;
+};
+
+DatalogServiceImpl::DatalogServiceImpl(StubEntryType stub_entry, ClientEngine* engine,
+                                       const DatalogQueue::Options& queue_options, size_t batch_size,
+                                       const std::unordered_map<std::string, std::string>& url_query) :
+    m_stub_entry(std::move(stub_entry)),
+    m_engine(engine),
+    m_queue_options(queue_options),
+    m_batch_size(batch_size),
+    m_compression(GRPC_COMPRESS_NONE) {
+  SPDLOG_TRACE("DatalogServiceImpl");
+
+  for (auto& [name, value] : url_query) {
+    if (name == "compression") {
+      if (value == "none") {
+        m_compression = GRPC_COMPRESS_NONE;
+      }
+      else if (value == "gzip") {
+        m_compression = GRPC_COMPRESS_GZIP;
+      }
+      else if (value == "deflate") {
+        m_compression = GRPC_COMPRESS_DEFLATE;
+      }
+      else {
+        throw MakeException("Unknown datalog compression [{}] (must be 'none', 'gzip' or 'deflate')", value);
+      }
+    }
+    else if (name == "obs_keyframe_interval") {
+      m_delta_encoder = make_delta_encoder(name, value);
     }
     else {
-      throw MakeException("DatalogService is not started");
+      spdlog::warn("Unknown datalog url parameter [{}]", name);
+    }
+  }
+}
+
+DatalogServiceImpl::~DatalogServiceImpl() {
+  SPDLOG_TRACE("~DatalogServiceImpl()");
+
+  // The stream will finish on its own after all queued samples are sent
+  if (m_writer != nullptr) {
+    m_writer->close();
+  }
+}
+
+void DatalogServiceImpl::start(const std::string& trial_id, const std::string& user_id,
+                               const cogmentAPI::TrialParams& params) {
+  if (m_writer != nullptr) {
+    throw MakeException("DatalogService already started for [{}] cannot start for [{}]", m_trial_id, trial_id);
+  }
+  m_trial_id = trial_id;
+  m_exclude_fields = parse_exclude_fields(m_trial_id, params);
+
+  auto stream = StreamType::make(m_engine);
+  stream->context()->AddMetadata("trial-id", m_trial_id);
+  stream->context()->AddMetadata("user-id", user_id);
+  stream->context()->set_compression_algorithm(m_compression);
+  auto call =
+      m_stub_entry->get_generic_stub().PrepareCall(stream->context(), RUN_TRIAL_DATALOG_METHOD, stream->queue());
+
+  m_writer = std::make_shared<Writer>(stream, m_queue_options, m_batch_size, m_trial_id);
+
+  cogmentAPI::RunTrialDatalogInput msg;
+  *msg.mutable_trial_params() = params;
+  m_writer->write(msg);
+
+  // The handlers must not refer to this object: the stream may outlive it.
+  // The writer is released by the stream when it finishes.
+  auto trial_id = m_trial_id;
+  auto writer = m_writer;
+  stream->set_written_handler([writer]() {
+    writer->written();
+  });
+  stream->start(
+      std::move(call), [](grpc::ByteBuffer&&) {},
+      [trial_id, writer](const grpc::Status& status) {
+        if (!status.ok()) {
+          spdlog::error("Trial [{}] - Datalog stream failed [{}]", trial_id, status.error_message());
+        }
+        writer->stream_done();
+      });
+}
+
+void DatalogServiceImpl::add_sample(cogmentAPI::DatalogSample& sample) {
+  if (m_writer == nullptr) {
+    throw MakeException("DatalogService is not started");
+  }
+
+  clear_fields(m_exclude_fields, &sample);
+  if (m_delta_encoder != nullptr) {
+    m_delta_encoder->encode(&sample);
+  }
+  m_writer->push(&sample);
+}
+
+// Compresses blocks independently, as complete gzip members
+class DatalogServiceFile::Compressor {
+public:
+  Compressor(int level) {
+    std::memset(&m_stream, 0, sizeof(m_stream));
+    constexpr int GZIP_WINDOW_BITS = 15 + 16;
+    constexpr int MEMORY_LEVEL = 8;
+    if (deflateInit2(&m_stream, level, Z_DEFLATED, GZIP_WINDOW_BITS, MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw MakeException("Could not initialize datalog compression (level [{}])", level);
+    }
+  }
+
+  ~Compressor() { deflateEnd(&m_stream); }
+
+  Compressor(const Compressor&) = delete;
+  void operator=(const Compressor&) = delete;
+
+  // The result is valid until the next call
+  const std::string& compress(const std::string& data) {
+    if (deflateReset(&m_stream) != Z_OK) {
+      throw MakeException("Could not reset datalog compression");
+    }
+
+    m_output.resize(deflateBound(&m_stream, data.size()));
+    m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    m_stream.avail_in = data.size();
+    m_stream.next_out = reinterpret_cast<Bytef*>(m_output.data());
+    m_stream.avail_out = m_output.size();
+
+    if (deflate(&m_stream, Z_FINISH) != Z_STREAM_END) {
+      throw MakeException("Datalog compression failed [{}]", (m_stream.msg != nullptr) ? m_stream.msg : "");
     }
+    m_output.resize(m_stream.total_out);
+
+    return m_output;
+  }
+
+private:
+  z_stream m_stream;
+  std::string m_output;
+};
+
+DatalogServiceFile::DatalogServiceFile(const std::string& url, ThreadPool* pool,
+                                       const DatalogQueue::Options& queue_options, const Metrics& metrics) :
+    m_pool(pool),
+    m_queue_options(queue_options),
+    m_metrics(metrics),
+    m_max_file_size(DEFAULT_MAX_FILE_SIZE),
+    m_max_file_age(0),
+    m_draining(false),
+    m_file(nullptr),
+    m_file_index(0),
+    m_file_size(0),
+    m_file_start(0) {
+  SPDLOG_TRACE("DatalogServiceFile");
+
+  if (url.find(FILE_SCHEME) != 0) {
+    throw MakeException("Bad file url (must start with '{}'): [{}]", FILE_SCHEME, url);
+  }
+
+  std::unordered_map<std::string, std::string> query;
+  m_directory = split_url_query(url, &query).substr(FILE_SCHEME.size());
+  if (m_directory.empty()) {
+    throw MakeException("Datalog file url has no directory: [{}]", url);
+  }
+
+  std::string compression = "none";
+  int compression_level = Z_DEFAULT_COMPRESSION;
+  for (auto& [name, value] : query) {
+    try {
+      if (name == "compression") {
+        compression = value;
+      }
+      else if (name == "compression_level") {
+        compression_level = std::stoi(value);
+      }
+      else if (name == "obs_keyframe_interval") {
+        m_delta_encoder = make_delta_encoder(name, value);
+      }
+      else if (name == "max_file_size") {
+        m_max_file_size = std::stoull(value);
+      }
+      else if (name == "max_file_age") {
+        m_max_file_age = std::stoull(value) * NANOS;
+      }
+      else {
+        spdlog::warn("Unknown datalog file url parameter [{}] in [{}]", name, url);
+      }
+    }
+    catch (const std::logic_error&) {
+      throw MakeException("Invalid value for datalog file url parameter [{}]: [{}]", name, value);
+    }
+  }
+
+  if (compression == "gzip") {
+    m_compressor = std::make_unique<Compressor>(compression_level);
+  }
+  else if (compression != "none") {
+    throw MakeException("Unknown datalog file compression [{}] (must be 'none' or 'gzip')", compression);
+  }
+}
+
+DatalogServiceFile::~DatalogServiceFile() {
+  SPDLOG_TRACE("~DatalogServiceFile()");
+
+  // No drain task can be running since they hold a reference to this object
+  if (m_queue != nullptr) {
+    drain();
+  }
+
+  try {
+    const std::lock_guard lg(m_lock);
+    close_file();
+  }
+  catch (const std::exception& exc) {
+    spdlog::error("Trial [{}] - Failed to close datalog file: [{}]", m_trial_id, exc.what());
+  }
+  catch (...) {
+    spdlog::error("Trial [{}] - Failed to close datalog file", m_trial_id);
+  }
+}
+
+void DatalogServiceFile::start(const std::string& trial_id, const std::string& user_id,
+                               const cogmentAPI::TrialParams& params) {
+  const std::lock_guard lg(m_lock);
+
+  if (!m_trial_id.empty()) {
+    throw MakeException("DatalogService already started for [{}] cannot start for [{}]", m_trial_id, trial_id);
+  }
+
+  // The trial id is used as the file name, it must stay in the directory
+  const bool bad_name = (trial_id.empty() || trial_id.find_first_of(std::string("/\\\0", 3)) != std::string::npos ||
+                         trial_id.find("..") != std::string::npos);
+  if (bad_name) {
+    throw MakeException("Trial id [{}] cannot be used as a datalog file name", trial_id);
+  }
+
+  m_trial_id = trial_id;
+  m_exclude_fields = parse_exclude_fields(m_trial_id, params);
+  m_queue = std::make_unique<DatalogQueue>(m_queue_options, m_trial_id);
+
+  // The header is repeated at the start of every file so they can be read independently
+  append_varint(&m_header, params.ByteSizeLong());
+  params.AppendToString(&m_header);
+
+  std::error_code error;
+  std::filesystem::create_directories(m_directory, error);
+  if (error) {
+    throw MakeException("Could not create datalog directory [{}]: [{}]", m_directory, error.message());
   }
+
+  open_file();
 }
 
-void DatalogServiceImpl::add_sample(cogmentAPI::DatalogSample&& sample) {
-  if (m_exclude_fields.none()) {
-    dispatch_sample(std::move(sample));
+void DatalogServiceFile::add_sample(cogmentAPI::DatalogSample& sample) {
+  if (m_queue == nullptr) {
+    throw MakeException("DatalogService is not started");
   }
-  else {
-    if (m_exclude_fields[OBSERVATIONS_FIELD]) {
-      sample.clear_observations();
+  m_queue->push(&sample);
+
+  const std::lock_guard lg(m_drain_lock);
+  if (!m_draining) {
+    m_draining = true;
+    m_pool->push("Datalog file writing", [self = shared_from_this()]() {
+      self->drain();
+    });
+  }
+}
+
+// Writes the queued samples until the queue is empty
+void DatalogServiceFile::drain() {
+  const std::lock_guard lg(m_lock);
+
+  while (true) {
+    {
+      const std::lock_guard drain_lg(m_drain_lock);
+      if (!m_queue->pop(&m_sample)) {
+        m_draining = false;
+        return;
+      }
     }
-    if (m_exclude_fields[ACTIONS_FIELD]) {
-      sample.clear_actions();
+
+    try {
+      write_sample();
+    }
+    catch (const std::exception& exc) {
+      spdlog::error("Trial [{}] - Failed to write datalog sample: [{}]", m_trial_id, exc.what());
     }
-    if (m_exclude_fields[REWARDS_FIELD]) {
-      sample.clear_rewards();
+    catch (...) {
+      spdlog::error("Trial [{}] - Failed to write datalog sample", m_trial_id);
     }
-    if (m_exclude_fields[MESSAGES_FIELD]) {
-      sample.clear_messages();
+  }
+}
+
+// Must be called with m_lock held
+void DatalogServiceFile::write_sample() {
+  if (m_file == nullptr) {
+    throw MakeException("Datalog file is not open");
+  }
+
+  const bool too_big = (m_file_size + m_buffer.size() >= m_max_file_size);
+  const bool too_old = (m_max_file_age > 0 && Timestamp() - m_file_start >= m_max_file_age);
+  if (too_big || too_old) {
+    close_file();
+    open_file();
+  }
+
+  clear_fields(m_exclude_fields, &m_sample);
+  if (m_delta_encoder != nullptr) {
+    m_delta_encoder->encode(&m_sample);
+  }
+  append_record(m_sample);
+}
+
+// Must be called with m_lock held
+void DatalogServiceFile::open_file() {
+  const char* const extension = (m_compressor != nullptr) ? ".datalog.gz" : ".datalog";
+  auto filename = fmt::format("{}/{}.{:04}{}", m_directory, m_trial_id, m_file_index, extension);
+  m_file = std::fopen(filename.c_str(), "ab");
+  if (m_file == nullptr) {
+    throw MakeException("Could not open datalog file [{}]: [{}]", filename, std::strerror(errno));
+  }
+  spdlog::debug("Trial [{}] - Datalog file [{}] opened", m_trial_id, filename);
+
+  m_file_index++;
+  m_file_size = 0;
+  m_file_start = Timestamp();
+  m_buffer.append(m_header);
+}
+
+// Must be called with m_lock held
+void DatalogServiceFile::close_file() {
+  if (m_file == nullptr) {
+    return;
+  }
+
+  flush();
+  std::fclose(m_file);
+  m_file = nullptr;
+}
+
+// Must be called with m_lock held
+void DatalogServiceFile::append_record(const google::protobuf::MessageLite& msg) {
+  append_varint(&m_buffer, msg.ByteSizeLong());
+  msg.AppendToString(&m_buffer);
+
+  if (m_buffer.size() >= FILE_WRITE_SIZE) {
+    flush();
+  }
+}
+
+// Must be called with m_lock held
+void DatalogServiceFile::flush() {
+  if (m_buffer.empty()) {
+    return;
+  }
+
+  const std::string* data = &m_buffer;
+  if (m_compressor != nullptr) {
+    const double start_time = thread_cpu_seconds();
+    data = &m_compressor->compress(m_buffer);
+
+    if (m_metrics.compression_seconds != nullptr) {
+      m_metrics.compression_seconds->Increment(thread_cpu_seconds() - start_time);
     }
-    if (m_exclude_fields[INFO_FIELD]) {
-      sample.clear_info();
+    if (m_metrics.compression_ratio != nullptr && !data->empty()) {
+      m_metrics.compression_ratio->Observe(static_cast<double>(m_buffer.size()) / data->size());
     }
+  }
 
-    dispatch_sample(std::move(sample));
+  const size_t written = std::fwrite(data->data(), 1, data->size(), m_file);
+  const bool success = (written == data->size());
+  m_file_size += written;
+  m_buffer.clear();
+  if (!success) {
+    throw MakeException("Failed to write to datalog file: [{}]", std::strerror(errno));
   }
 }
 
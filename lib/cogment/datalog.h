@@ -16,12 +16,21 @@
 #define COGMENT_ORCHESTRATOR_DATALOG_H
 
 #include "cogment/actor.h"
+#include "cogment/async_client.h"
+#include "cogment/datalog_delta.h"
+#include "cogment/datalog_queue.h"
 #include "cogment/stub_pool.h"
 
 #include "cogment/api/datalog.grpc.pb.h"
 #include "cogment/api/common.pb.h"
 
+#include "prometheus/counter.h"
+#include "prometheus/summary.h"
+
 #include <bitset>
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
 
 namespace cogment {
 
@@ -32,36 +41,111 @@ public:
   virtual ~DatalogService() {}
   virtual void start(const std::string& trial_id, const std::string& user_id,
                      const cogmentAPI::TrialParams& params) = 0;
-  virtual void add_sample(cogmentAPI::DatalogSample&& data) = 0;
+
+  // The sample content is undefined after the call (the sample object is reused by the caller)
+  virtual void add_sample(cogmentAPI::DatalogSample& data) = 0;
+
+protected:
+  static constexpr size_t NB_BITS = 5;
+  using FieldSet = std::bitset<NB_BITS>;
+
+  static FieldSet parse_exclude_fields(const std::string& trial_id, const cogmentAPI::TrialParams& params);
+  static void clear_fields(const FieldSet& fields, cogmentAPI::DatalogSample* sample);
 };
 
 class DatalogServiceNull : public DatalogService {
 public:
   void start(const std::string& trial_id, const std::string& user_id, const cogmentAPI::TrialParams& params) override {}
-  void add_sample(cogmentAPI::DatalogSample&& data) override {}
+  void add_sample(cogmentAPI::DatalogSample& data) override {}
 };
 
 class DatalogServiceImpl : public DatalogService {
   using StubEntryType = std::shared_ptr<StubPool<cogmentAPI::DatalogSP>::Entry>;
+  using StreamType = AsyncClientStream<grpc::ByteBuffer, grpc::ByteBuffer>;
 
 public:
-  DatalogServiceImpl(StubEntryType stub_entry);
+  // Endpoint query parameters:
+  //   compression: gRPC message compression ("none", "gzip" or "deflate")
+  //   obs_keyframe_interval: Observations are delta encoded, with a keyframe every N samples (0: no encoding)
+  DatalogServiceImpl(StubEntryType stub_entry, ClientEngine* engine, const DatalogQueue::Options& queue_options,
+                     size_t batch_size, const std::unordered_map<std::string, std::string>& url_query);
   ~DatalogServiceImpl();
 
   void start(const std::string& trial_id, const std::string& user_id, const cogmentAPI::TrialParams& params) override;
-  void add_sample(cogmentAPI::DatalogSample&& data) override;
+  void add_sample(cogmentAPI::DatalogSample& data) override;
 
 private:
-  static constexpr size_t NB_BITS = 5;
-  void dispatch_sample(cogmentAPI::DatalogSample&& data);
+  class Writer;
 
   StubEntryType m_stub_entry;
-  std::unique_ptr<grpc::ClientReaderWriter<cogmentAPI::RunTrialDatalogInput, cogmentAPI::RunTrialDatalogOutput>>
-      m_stream;
-  grpc::ClientContext m_context;
-  bool m_stream_valid;
+  ClientEngine* const m_engine;
+  const DatalogQueue::Options m_queue_options;
+  const size_t m_batch_size;
+  grpc_compression_algorithm m_compression;
+  std::unique_ptr<ObservationDeltaEncoder> m_delta_encoder;
+  std::shared_ptr<Writer> m_writer;
+  std::string m_trial_id;
+  FieldSet m_exclude_fields;
+};
+
+// Writes the samples to local files (for "file://" endpoints).
+// The samples are queued and written by a thread pool task, off the tick path.
+// It is shared with the pool tasks, so it can outlive its owner (it must be created with `std::make_shared`).
+// The files contain length-delimited (varint size prefix) records: a `cogmentAPI::TrialParams` header,
+// followed by `cogmentAPI::DatalogSample`s.
+// Endpoint query parameters:
+//   max_file_size: Size (in bytes) after which a new file is started
+//   max_file_age: Time (in seconds) after which a new file is started (0: never)
+//   compression: "none" or "gzip" (each written block is a gzip member, so the files can be read with standard tools)
+//   compression_level: 1 (fastest) to 9 (smallest)
+//   obs_keyframe_interval: Observations are delta encoded, with a keyframe every N samples (0: no encoding)
+class DatalogServiceFile : public DatalogService, public std::enable_shared_from_this<DatalogServiceFile> {
+public:
+  struct Metrics {
+    prometheus::Summary* compression_ratio = nullptr;
+    prometheus::Counter* compression_seconds = nullptr;
+  };
+
+  DatalogServiceFile(const std::string& url, ThreadPool* pool, const DatalogQueue::Options& queue_options,
+                     const Metrics& metrics);
+  ~DatalogServiceFile();
+
+  void start(const std::string& trial_id, const std::string& user_id, const cogmentAPI::TrialParams& params) override;
+  void add_sample(cogmentAPI::DatalogSample& data) override;
+
+private:
+  void drain();
+  void write_sample();
+  void open_file();
+  void close_file();
+  void append_record(const google::protobuf::MessageLite& msg);
+  void flush();
+
+  class Compressor;
+
+  ThreadPool* const m_pool;
+  const DatalogQueue::Options m_queue_options;
+  const Metrics m_metrics;
+  std::string m_directory;
+  uint64_t m_max_file_size;
+  uint64_t m_max_file_age;
+  std::unique_ptr<Compressor> m_compressor;
+  std::unique_ptr<ObservationDeltaEncoder> m_delta_encoder;
+
+  std::unique_ptr<DatalogQueue> m_queue;
+  std::mutex m_drain_lock;
+  bool m_draining;
+
+  std::mutex m_lock;
   std::string m_trial_id;
-  std::bitset<NB_BITS> m_exclude_fields;
+  FieldSet m_exclude_fields;
+  cogmentAPI::DatalogSample m_sample;
+  std::string m_header;
+  std::string m_buffer;
+  FILE* m_file;
+  uint32_t m_file_index;
+  uint64_t m_file_size;
+  uint64_t m_file_start;
 };
 
 }  // namespace cogment
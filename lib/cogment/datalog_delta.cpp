@@ -0,0 +1,199 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/datalog_delta.h"
+#include "cogment/utils.h"
+
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cogment {
+namespace {
+
+// Shorter runs of identical bytes are kept in the literals (they would cost more to encode separately)
+constexpr size_t MIN_COPY_SIZE = 4;
+
+bool is_copy_run(const std::string& base, const std::string& current, size_t pos, size_t common_size) {
+  if (pos + MIN_COPY_SIZE > common_size) {
+    return false;
+  }
+  return (std::memcmp(base.data() + pos, current.data() + pos, MIN_COPY_SIZE) == 0);
+}
+
+// Returns the index of the delta marker in the special events, or -1 if not found
+int find_delta_event(const cogmentAPI::SampleInfo& info) {
+  const size_t prefix_size = std::strlen(DELTA_EVENT_PREFIX);
+  for (int index = 0; index < info.special_events_size(); index++) {
+    if (info.special_events(index).compare(0, prefix_size, DELTA_EVENT_PREFIX) == 0) {
+      return index;
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+void encode_delta(const std::string& base, const std::string& current, std::string* delta) {
+  delta->clear();
+  append_varint(delta, current.size());
+
+  const size_t size = current.size();
+  const size_t common_size = std::min(base.size(), size);
+  size_t pos = 0;
+  while (pos < size) {
+    const size_t copy_start = pos;
+    while (pos < common_size && base[pos] == current[pos]) {
+      pos++;
+    }
+    const size_t copy_size = pos - copy_start;
+
+    const size_t literal_start = pos;
+    while (pos < size && !is_copy_run(base, current, pos, common_size)) {
+      pos++;
+    }
+    const size_t literal_size = pos - literal_start;
+
+    append_varint(delta, copy_size);
+    append_varint(delta, literal_size);
+    delta->append(current, literal_start, literal_size);
+  }
+}
+
+bool decode_delta(const std::string& base, const std::string& delta, std::string* current) {
+  const char* pos = delta.data();
+  const char* const end = pos + delta.size();
+
+  uint64_t size;
+  if (!read_varint(&pos, end, &size)) {
+    return false;
+  }
+  current->resize(size);
+
+  uint64_t current_pos = 0;
+  while (current_pos < size) {
+    uint64_t copy_size;
+    uint64_t literal_size;
+    if (!read_varint(&pos, end, &copy_size) || !read_varint(&pos, end, &literal_size)) {
+      return false;
+    }
+    if (copy_size > size - current_pos || current_pos + copy_size > base.size()) {
+      return false;
+    }
+    if (literal_size > size - current_pos - copy_size || literal_size > static_cast<uint64_t>(end - pos)) {
+      return false;
+    }
+
+    std::memcpy(current->data() + current_pos, base.data() + current_pos, copy_size);
+    current_pos += copy_size;
+    std::memcpy(current->data() + current_pos, pos, literal_size);
+    current_pos += literal_size;
+    pos += literal_size;
+  }
+
+  return (pos == end);
+}
+
+ObservationDeltaEncoder::ObservationDeltaEncoder(uint32_t keyframe_interval) :
+    m_keyframe_interval(keyframe_interval), m_has_previous(false), m_nb_since_keyframe(0), m_previous_tick_id(0) {}
+
+void ObservationDeltaEncoder::encode(cogmentAPI::DatalogSample* sample) {
+  if (m_keyframe_interval == 0 || !sample->has_observations()) {
+    return;
+  }
+
+  auto observations = sample->mutable_observations();
+  const auto nb_obs = static_cast<size_t>(observations->observations_size());
+  const uint64_t tick_id = sample->info().tick_id();
+
+  // The previous observations are kept raw, and the sample ones are replaced by the delta (swapping buffers)
+  const bool keyframe =
+      (!m_has_previous || m_nb_since_keyframe + 1 >= m_keyframe_interval || m_previous.size() != nb_obs);
+  if (keyframe) {
+    m_nb_since_keyframe = 0;
+    for (size_t index = 0; index < nb_obs; index++) {
+      if (index < m_previous.size()) {
+        m_previous[index] = observations->observations(index);
+      }
+      else {
+        m_previous.emplace_back(observations->observations(index));
+      }
+    }
+    m_previous.resize(nb_obs);
+  }
+  else {
+    m_nb_since_keyframe++;
+    for (size_t index = 0; index < nb_obs; index++) {
+      auto obs = observations->mutable_observations(index);
+      encode_delta(m_previous[index], *obs, &m_delta);
+      m_previous[index].swap(*obs);
+      obs->swap(m_delta);
+    }
+    sample->mutable_info()->add_special_events(fmt::format("{}{}", DELTA_EVENT_PREFIX, m_previous_tick_id));
+  }
+
+  m_has_previous = true;
+  m_previous_tick_id = tick_id;
+}
+
+ObservationDeltaDecoder::ObservationDeltaDecoder() : m_has_previous(false), m_previous_tick_id(0) {}
+
+bool ObservationDeltaDecoder::decode(cogmentAPI::DatalogSample* sample) {
+  if (!sample->has_observations()) {
+    return true;
+  }
+
+  auto observations = sample->mutable_observations();
+  const auto nb_obs = static_cast<size_t>(observations->observations_size());
+  const uint64_t tick_id = sample->info().tick_id();
+
+  const int event_index = find_delta_event(sample->info());
+  if (event_index < 0) {
+    m_previous.assign(observations->observations().begin(), observations->observations().end());
+    m_has_previous = true;
+    m_previous_tick_id = tick_id;
+    return true;
+  }
+
+  auto events = sample->mutable_info()->mutable_special_events();
+  const std::string base_tick = events->Get(event_index).substr(std::strlen(DELTA_EVENT_PREFIX));
+  events->erase(events->begin() + event_index);
+
+  if (!m_has_previous || m_previous.size() != nb_obs || base_tick != std::to_string(m_previous_tick_id)) {
+    spdlog::debug("Missing base sample [{}] to decode observations of tick [{}]", base_tick, tick_id);
+    m_has_previous = false;
+    return false;
+  }
+
+  for (size_t index = 0; index < nb_obs; index++) {
+    auto obs = observations->mutable_observations(index);
+    if (!decode_delta(m_previous[index], *obs, &m_current)) {
+      spdlog::debug("Malformed observation delta for tick [{}]", tick_id);
+      m_has_previous = false;
+      return false;
+    }
+    m_previous[index] = m_current;
+    obs->swap(m_current);
+  }
+  m_previous_tick_id = tick_id;
+
+  return true;
+}
+
+}  // namespace cogment
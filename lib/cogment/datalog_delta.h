@@ -0,0 +1,76 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_DATALOG_DELTA_H
+#define COGMENT_ORCHESTRATOR_DATALOG_DELTA_H
+
+#include "cogment/api/datalog.pb.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cogment {
+
+// Observations of delta encoded samples are replaced by the difference with the observations
+// of a previous sample (the base). These samples are marked with a special event:
+// "<DELTA_EVENT_PREFIX><base tick id>".
+// Delta format (per observation): varint size of the observation, followed by a sequence of
+// [varint nb bytes copied from base][varint nb literal bytes][literal bytes].
+constexpr const char* DELTA_EVENT_PREFIX = "cogment.observations_delta:";
+
+// Returns a delta that recreates `current` from `base`.
+void encode_delta(const std::string& base, const std::string& current, std::string* delta);
+
+// Returns false if the delta is malformed or does not match the base.
+bool decode_delta(const std::string& base, const std::string& delta, std::string* current);
+
+// Encodes a keyframe (full observations) every `keyframe_interval` samples,
+// and the others as deltas from the previous sample.
+// Samples must be encoded in tick order.
+class ObservationDeltaEncoder {
+public:
+  ObservationDeltaEncoder(uint32_t keyframe_interval);
+
+  bool enabled() const { return (m_keyframe_interval > 0); }
+  void encode(cogmentAPI::DatalogSample* sample);
+
+private:
+  const uint32_t m_keyframe_interval;
+  bool m_has_previous;
+  uint32_t m_nb_since_keyframe;
+  uint64_t m_previous_tick_id;
+  std::vector<std::string> m_previous;
+  std::string m_delta;
+};
+
+// Reverses the encoding of `ObservationDeltaEncoder`.
+// Samples must be decoded in tick order (keyframes and samples without marker are passed through).
+class ObservationDeltaDecoder {
+public:
+  ObservationDeltaDecoder();
+
+  // Returns false if the sample cannot be decoded (e.g. the base sample was lost);
+  // the following samples will fail until the next keyframe.
+  bool decode(cogmentAPI::DatalogSample* sample);
+
+private:
+  bool m_has_previous;
+  uint64_t m_previous_tick_id;
+  std::vector<std::string> m_previous;
+  std::string m_current;
+};
+
+}  // namespace cogment
+#endif
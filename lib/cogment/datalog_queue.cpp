@@ -0,0 +1,350 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/datalog_queue.h"
+#include "cogment/async_client.h"
+#include "cogment/utils.h"
+
+#include "spdlog/spdlog.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cogment {
+
+// Static
+DatalogQueue::OverflowPolicy DatalogQueue::policy_from_string(std::string policy) {
+  std::transform(policy.begin(), policy.end(), policy.begin(), ::tolower);
+
+  if (policy == "block") {
+    return OverflowPolicy::block;
+  }
+  else if (policy == "drop_oldest") {
+    return OverflowPolicy::drop_oldest;
+  }
+  else if (policy == "spill") {
+    return OverflowPolicy::spill;
+  }
+  else {
+    throw MakeException("Unknown datalog overflow policy [{}] (must be 'block', 'drop_oldest' or 'spill')", policy);
+  }
+}
+
+DatalogQueue::DatalogQueue(const Options& options, const std::string& trial_id) :
+    m_options(options),
+    m_trial_id(trial_id),
+    m_closed(false),
+    m_held_overflowing(false),
+    m_spill_file(nullptr),
+    m_spill_read_pos(0),
+    m_spill_write_pos(0),
+    m_nb_spilled(0) {
+  if (m_options.max_size == 0) {
+    throw MakeException("Datalog queue size must be greater than 0");
+  }
+}
+
+DatalogQueue::~DatalogQueue() {
+  const size_t nb_lost = m_entries.size() + m_held_entries.size() + m_nb_spilled;
+  if (nb_lost > 0) {
+    spdlog::warn("Trial [{}] - [{}] samples not sent to datalog", m_trial_id, nb_lost);
+    drop(nb_lost);
+  }
+
+  if (m_spill_file != nullptr) {
+    std::fclose(m_spill_file);
+  }
+}
+
+void DatalogQueue::drop(size_t nb_samples) {
+  if (m_options.metrics.depth != nullptr) {
+    m_options.metrics.depth->Decrement(static_cast<double>(nb_samples));
+  }
+  if (m_options.metrics.dropped != nullptr) {
+    m_options.metrics.dropped->Increment(static_cast<double>(nb_samples));
+  }
+}
+
+void DatalogQueue::observe_lag(uint64_t timestamp) {
+  if (m_options.metrics.depth != nullptr) {
+    m_options.metrics.depth->Decrement();
+  }
+  if (m_options.metrics.lag != nullptr) {
+    const uint64_t now = Timestamp();
+    const uint64_t lag = (now > timestamp) ? (now - timestamp) : 0;
+    m_options.metrics.lag->Observe(static_cast<double>(lag) * NANOS_INV);
+  }
+}
+
+// Must be called with m_lock held
+std::unique_ptr<DatalogQueue::Entry> DatalogQueue::make_entry(cogmentAPI::DatalogSample* sample, uint64_t timestamp) {
+  std::unique_ptr<Entry> entry;
+  if (!m_free_entries.empty()) {
+    entry = std::move(m_free_entries.back());
+    m_free_entries.pop_back();
+  }
+  else {
+    entry = std::make_unique<Entry>();
+  }
+
+  entry->sample.Swap(sample);
+  entry->timestamp = timestamp;
+  return entry;
+}
+
+void DatalogQueue::push(cogmentAPI::DatalogSample* sample) {
+  const uint64_t timestamp = Timestamp();
+  const std::lock_guard lg(m_lock);
+
+  if (m_options.metrics.depth != nullptr) {
+    m_options.metrics.depth->Increment();
+  }
+
+  if (m_closed) {
+    drop(1);
+    return;
+  }
+
+  // To keep the order, everything goes to the spill file until it is empty
+  if (m_nb_spilled > 0) {
+    spill(sample, timestamp);
+    return;
+  }
+
+  if (m_entries.size() >= m_options.max_size) {
+    switch (m_options.policy) {
+    case OverflowPolicy::block:
+      hold(sample, timestamp);
+      return;
+
+    case OverflowPolicy::drop_oldest:
+      m_free_entries.emplace_back(std::move(m_entries.front()));
+      m_entries.pop_front();
+      m_free_entries.back()->sample.Clear();
+      drop(1);
+      break;
+
+    case OverflowPolicy::spill:
+      spill(sample, timestamp);
+      return;
+    }
+  }
+
+  m_entries.emplace_back(make_entry(sample, timestamp));
+}
+
+// The held back samples are bounded like the queue: past that, the oldest sample (at the front of the
+// queue) is discarded and the oldest held sample takes its place.
+// Must be called with m_lock held
+void DatalogQueue::hold(cogmentAPI::DatalogSample* sample, uint64_t timestamp) {
+  if (m_held_entries.size() < m_options.max_size) {
+    m_held_overflowing = false;
+  }
+  else {
+    if (!m_held_overflowing) {
+      spdlog::warn("Trial [{}] - Datalog queue full, dropping the oldest samples", m_trial_id);
+      m_held_overflowing = true;
+    }
+    if (m_options.metrics.held_overflow != nullptr) {
+      m_options.metrics.held_overflow->Increment();
+    }
+
+    m_free_entries.emplace_back(std::move(m_entries.front()));
+    m_entries.pop_front();
+    m_free_entries.back()->sample.Clear();
+    drop(1);
+
+    m_entries.emplace_back(std::move(m_held_entries.front()));
+    m_held_entries.pop_front();
+  }
+
+  m_held_entries.emplace_back(make_entry(sample, timestamp));
+}
+
+// Must be called with m_lock held
+std::unique_ptr<DatalogQueue::Entry> DatalogQueue::pop_entry() {
+  auto entry = std::move(m_entries.front());
+  m_entries.pop_front();
+
+  if (!m_held_entries.empty()) {
+    m_entries.emplace_back(std::move(m_held_entries.front()));
+    m_held_entries.pop_front();
+  }
+
+  return entry;
+}
+
+bool DatalogQueue::pop(grpc::ByteBuffer* out) {
+  std::unique_ptr<Entry> entry;
+  {
+    const std::lock_guard lg(m_lock);
+
+    if (!m_entries.empty()) {
+      entry = pop_entry();
+    }
+    else if (m_nb_spilled > 0) {
+      uint64_t timestamp = 0;
+      if (!unspill(&timestamp)) {
+        return false;
+      }
+      grpc::Slice slice(m_spill_buffer.data(), m_spill_buffer.size());
+      *out = grpc::ByteBuffer(&slice, 1);
+      observe_lag(timestamp);
+      return true;
+    }
+    else {
+      return false;
+    }
+  }
+  observe_lag(entry->timestamp);
+
+  // Serialization is done outside the lock to not hold the producers
+  m_pop_msg.mutable_sample()->Swap(&entry->sample);
+  try {
+    *out = SerializeMessage(m_pop_msg);
+  }
+  catch (const std::exception& exc) {
+    spdlog::error("Trial [{}] - Failed to serialize datalog sample [{}]", m_trial_id, exc.what());
+  }
+  catch (...) {
+    spdlog::error("Trial [{}] - Failed to serialize datalog sample", m_trial_id);
+  }
+  m_pop_msg.mutable_sample()->Swap(&entry->sample);
+  entry->sample.Clear();
+
+  const std::lock_guard lg(m_lock);
+  m_free_entries.emplace_back(std::move(entry));
+  return true;
+}
+
+bool DatalogQueue::pop(cogmentAPI::DatalogSample* out) {
+  const std::lock_guard lg(m_lock);
+
+  if (!m_entries.empty()) {
+    auto entry = pop_entry();
+    observe_lag(entry->timestamp);
+
+    out->Swap(&entry->sample);
+    entry->sample.Clear();
+    m_free_entries.emplace_back(std::move(entry));
+    return true;
+  }
+
+  while (m_nb_spilled > 0) {
+    uint64_t timestamp = 0;
+    if (!unspill(&timestamp)) {
+      return false;
+    }
+
+    if (m_spill_msg.ParseFromString(m_spill_buffer)) {
+      observe_lag(timestamp);
+      out->Swap(m_spill_msg.mutable_sample());
+      return true;
+    }
+    spdlog::error("Trial [{}] - Failed to parse datalog sample from spill file", m_trial_id);
+    drop(1);
+  }
+
+  return false;
+}
+
+bool DatalogQueue::empty() {
+  const std::lock_guard lg(m_lock);
+  return (m_entries.empty() && m_nb_spilled == 0);
+}
+
+void DatalogQueue::close() {
+  const std::lock_guard lg(m_lock);
+  m_closed = true;
+}
+
+// Spill file records: [timestamp: uint64][size: uint32][serialized RunTrialDatalogInput]
+// Must be called with m_lock held
+void DatalogQueue::spill(cogmentAPI::DatalogSample* sample, uint64_t timestamp) {
+  if (m_spill_file == nullptr) {
+    m_spill_file = std::tmpfile();
+    if (m_spill_file == nullptr) {
+      spdlog::error("Trial [{}] - Could not create datalog spill file [{}]", m_trial_id, strerror(errno));
+      drop(1);
+      return;
+    }
+  }
+  if (m_nb_spilled == 0) {
+    spdlog::warn("Trial [{}] - Datalog queue full, spilling samples to disk", m_trial_id);
+  }
+
+  m_spill_msg.mutable_sample()->Swap(sample);
+  const bool serialized = m_spill_msg.SerializeToString(&m_spill_buffer);
+  m_spill_msg.mutable_sample()->Swap(sample);
+  if (!serialized) {
+    spdlog::error("Trial [{}] - Failed to serialize datalog sample", m_trial_id);
+    drop(1);
+    return;
+  }
+
+  const uint32_t size = static_cast<uint32_t>(m_spill_buffer.size());
+  bool success = (std::fseek(m_spill_file, m_spill_write_pos, SEEK_SET) == 0);
+  success = success && (std::fwrite(&timestamp, sizeof(timestamp), 1, m_spill_file) == 1);
+  success = success && (std::fwrite(&size, sizeof(size), 1, m_spill_file) == 1);
+  success = success && (std::fwrite(m_spill_buffer.data(), 1, size, m_spill_file) == size);
+  if (!success) {
+    spdlog::error("Trial [{}] - Failed to write datalog sample to spill file", m_trial_id);
+    drop(1);
+    return;
+  }
+
+  m_spill_write_pos = std::ftell(m_spill_file);
+  m_nb_spilled++;
+}
+
+// Must be called with m_lock held
+// The serialized record is left in m_spill_buffer
+bool DatalogQueue::unspill(uint64_t* timestamp) {
+  uint32_t size = 0;
+  bool success = (std::fflush(m_spill_file) == 0);
+  success = success && (std::fseek(m_spill_file, m_spill_read_pos, SEEK_SET) == 0);
+  success = success && (std::fread(timestamp, sizeof(*timestamp), 1, m_spill_file) == 1);
+  success = success && (std::fread(&size, sizeof(size), 1, m_spill_file) == 1);
+  if (success) {
+    m_spill_buffer.resize(size);
+    success = (std::fread(m_spill_buffer.data(), 1, size, m_spill_file) == size);
+  }
+  if (!success) {
+    spdlog::error("Trial [{}] - Failed to read datalog spill file, [{}] samples lost", m_trial_id, m_nb_spilled);
+    drop(m_nb_spilled);
+    m_nb_spilled = 0;
+    m_spill_read_pos = 0;
+    m_spill_write_pos = 0;
+    return false;
+  }
+
+  m_nb_spilled--;
+  if (m_nb_spilled > 0) {
+    m_spill_read_pos = std::ftell(m_spill_file);
+  }
+  else {
+    // The file is reused from the start
+    m_spill_read_pos = 0;
+    m_spill_write_pos = 0;
+    spdlog::info("Trial [{}] - Datalog spill file emptied", m_trial_id);
+  }
+
+  return true;
+}
+
+}  // namespace cogment
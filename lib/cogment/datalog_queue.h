@@ -0,0 +1,121 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_DATALOG_QUEUE_H
+#define COGMENT_ORCHESTRATOR_DATALOG_QUEUE_H
+
+#include "grpc++/grpc++.h"
+#include "prometheus/counter.h"
+#include "prometheus/gauge.h"
+#include "prometheus/summary.h"
+
+#include "cogment/api/datalog.pb.h"
+
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cogment {
+
+// Bounded queue of samples waiting to be sent to a datalog.
+// There can be many producers, but only one consumer at a time.
+class DatalogQueue {
+public:
+  // What happens to a new sample when the queue is full:
+  //   block: The sample is held back until there is space in the queue. The producer never waits
+  //          (it may be a completion queue thread that must not be held), so at most `max_size` samples
+  //          are held back; past that, the oldest sample is discarded (as with drop_oldest).
+  //   drop_oldest: The oldest sample in the queue is discarded
+  //   spill: The sample is stored in a temporary file until the queue drains
+  enum class OverflowPolicy { block, drop_oldest, spill };
+  static OverflowPolicy policy_from_string(std::string policy);
+
+  struct Metrics {
+    prometheus::Gauge* depth = nullptr;
+    prometheus::Summary* lag = nullptr;
+    prometheus::Counter* dropped = nullptr;
+    prometheus::Counter* held_overflow = nullptr;  // Samples dropped because too many were held back (block)
+  };
+
+  struct Options {
+    size_t max_size = 1000;
+    OverflowPolicy policy = OverflowPolicy::block;
+    Metrics metrics;
+  };
+
+  DatalogQueue(const Options& options, const std::string& trial_id);
+  ~DatalogQueue();
+
+  DatalogQueue(const DatalogQueue&) = delete;
+  DatalogQueue(DatalogQueue&&) = delete;
+  void operator=(const DatalogQueue&) = delete;
+  void operator=(DatalogQueue&&) = delete;
+
+  // The content of the sample is moved (swapped) in the queue, the sample is left empty
+  // but with recycled memory.
+  void push(cogmentAPI::DatalogSample* sample);
+
+  // Returns false if the queue is empty.
+  // The output is a serialized `cogmentAPI::RunTrialDatalogInput` containing the sample.
+  bool pop(grpc::ByteBuffer* out);
+
+  // Returns false if the queue is empty.
+  // The content of the output sample is replaced (its memory is recycled in the queue).
+  bool pop(cogmentAPI::DatalogSample* out);
+
+  bool empty();
+
+  // Samples pushed after this are dropped.
+  void close();
+
+private:
+  struct Entry {
+    cogmentAPI::DatalogSample sample;
+    uint64_t timestamp;
+  };
+
+  std::unique_ptr<Entry> make_entry(cogmentAPI::DatalogSample* sample, uint64_t timestamp);
+  std::unique_ptr<Entry> pop_entry();
+  void hold(cogmentAPI::DatalogSample* sample, uint64_t timestamp);
+  void drop(size_t nb_samples);
+  void spill(cogmentAPI::DatalogSample* sample, uint64_t timestamp);
+  bool unspill(uint64_t* timestamp);
+  void observe_lag(uint64_t timestamp);
+
+  const Options m_options;
+  const std::string m_trial_id;
+
+  std::mutex m_lock;
+  bool m_closed;
+  std::deque<std::unique_ptr<Entry>> m_entries;
+  std::deque<std::unique_ptr<Entry>> m_held_entries;  // Samples waiting for space in the queue (block policy)
+  bool m_held_overflowing;
+  std::vector<std::unique_ptr<Entry>> m_free_entries;
+
+  // Samples are swapped in and out of these messages to serialize them in place
+  cogmentAPI::RunTrialDatalogInput m_pop_msg;
+  cogmentAPI::RunTrialDatalogInput m_spill_msg;
+
+  FILE* m_spill_file;
+  long m_spill_read_pos;
+  long m_spill_write_pos;
+  size_t m_nb_spilled;
+  std::string m_spill_buffer;
+};
+
+}  // namespace cogment
+#endif
@@ -23,10 +23,28 @@
 
 #include "spdlog/spdlog.h"
 
+namespace {
+
+const std::string RUN_TRIAL_METHOD = fmt::format("/{}/RunTrial", cogmentAPI::EnvironmentSP::service_full_name());
+
+}  // namespace
+
 namespace cogment {
 
-Environment::Environment(Trial* owner, const cogmentAPI::EnvironmentParams& params, StubEntryType stub_entry) :
+// Static
+std::shared_ptr<Environment::StreamType> Environment::open_stream(ClientEngine* engine,
+                                                                  const StubEntryType& stub_entry,
+                                                                  const std::string& trial_id) {
+  auto stream = StreamType::make(engine);
+  stream->context()->AddMetadata("trial-id", trial_id);
+  stream->open(stub_entry->get_generic_stub().PrepareCall(stream->context(), RUN_TRIAL_METHOD, stream->queue()));
+  return stream;
+}
+
+Environment::Environment(Trial* owner, const cogmentAPI::EnvironmentParams& params, StubEntryType stub_entry,
+                         std::shared_ptr<StreamType> opened_stream) :
     m_stub_entry(std::move(stub_entry)),
+    m_opened_stream(std::move(opened_stream)),
     m_stream_valid(false),
     m_trial(owner),
     m_name(params.name()),
@@ -40,8 +58,6 @@ Environment::Environment(Trial* owner, const cogmentAPI::EnvironmentParams& para
   if (m_has_config) {
     m_config_data = params.config().content();
   }
-
-  m_context.AddMetadata("trial-id", m_trial->id());
 }
 
 Environment::~Environment() {
@@ -49,29 +65,28 @@ Environment::~Environment() {
 
   finish_stream();
 
+  // The handlers must not be called after this
+  if (m_stream != nullptr) {
+    m_stream->cancel();
+    m_stream->wait_done();
+  }
+  if (m_opened_stream != nullptr) {
+    m_opened_stream->cancel();
+    m_opened_stream->wait_done();
+  }
+
   if (!m_init_completed) {
     m_init_prom.set_value();
   }
 
   if (!m_last_ack_received) {
-    m_last_ack_prom.set_value();
-  }
-
-  if (m_incoming_thread.valid()) {
-    m_incoming_thread.wait();
+    m_last_ack.set();
   }
 }
 
-void Environment::write_to_stream(cogmentAPI::EnvRunTrialInput&& data) {
-  const std::lock_guard lg(m_writing);
+void Environment::write_to_stream(const cogmentAPI::EnvRunTrialInput& data) {
   if (m_stream_valid) {
-    try {
-      m_stream_valid = m_stream->Write(std::move(data));
-    }
-    catch (...) {
-      m_stream_valid = false;
-      throw;
-    }
+    m_stream_valid = m_stream->write(SerializeMessage(data));
   }
   else {
     throw MakeException("Environment stream has closed");
@@ -79,64 +94,64 @@ void Environment::write_to_stream(cogmentAPI::EnvRunTrialInput&& data) {
 }
 
 void Environment::send_message(const cogmentAPI::Message& message, uint64_t tick_id) {
-  cogmentAPI::Message msg(message);
-  msg.set_tick_id(tick_id);
-  msg.set_receiver_name(m_name);  // Because of possible wildcards in message receiver
+  auto arena = m_trial->acquire_arena();
+  auto msg = arena.create<cogmentAPI::EnvRunTrialInput>();
+  msg->set_state(cogmentAPI::CommunicationState::NORMAL);
+
+  auto env_message = msg->mutable_message();
+  *env_message = message;
+  env_message->set_tick_id(tick_id);
+  env_message->set_receiver_name(m_name);  // Because of possible wildcards in message receiver
 
-  dispatch_message(std::move(msg));
+  write_to_stream(*msg);
 }
 
-void Environment::read_init_data() {
-  SPDLOG_TRACE("Environment read_init_data");
+bool Environment::process_init_data(cogmentAPI::EnvRunTrialOutput&& data) {
+  SPDLOG_TRACE("Environment process_init_data");
 
-  for (cogmentAPI::EnvRunTrialOutput data; m_stream_valid && m_stream->Read(&data); data.Clear()) {
-    const auto state = data.state();
-    const auto data_case = data.data_case();
+  const auto state = data.state();
+  const auto data_case = data.data_case();
 
-    switch (state) {
-    case cogmentAPI::CommunicationState::NORMAL: {
-      if (data_case == cogmentAPI::EnvRunTrialOutput::DataCase::kInitOutput) {
-        return;
-      }
-      else {
-        throw MakeException("Data [{}] received from before init data", static_cast<int>(data_case));
-      }
+  switch (state) {
+  case cogmentAPI::CommunicationState::NORMAL: {
+    if (data_case == cogmentAPI::EnvRunTrialOutput::DataCase::kInitOutput) {
+      return true;
     }
-
-    case cogmentAPI::CommunicationState::HEARTBEAT: {
-      if (data_case == cogmentAPI::EnvRunTrialOutput::DataCase::kDetails) {
-        spdlog::info("Heartbeat requested from environment: [{}]", data.details());
-      }
-      cogmentAPI::EnvRunTrialInput msg;
-      msg.set_state(cogmentAPI::CommunicationState::HEARTBEAT);
-      m_stream_valid = m_stream->Write(std::move(msg));
-      break;
+    else {
+      throw MakeException("Data [{}] received from before init data", static_cast<int>(data_case));
     }
+  }
 
-    case cogmentAPI::CommunicationState::LAST: {
-      throw MakeException("Unexpected reception of communication state (LAST) from environment");
+  case cogmentAPI::CommunicationState::HEARTBEAT: {
+    if (data_case == cogmentAPI::EnvRunTrialOutput::DataCase::kDetails) {
+      spdlog::info("Heartbeat requested from environment: [{}]", data.details());
     }
+    cogmentAPI::EnvRunTrialInput msg;
+    msg.set_state(cogmentAPI::CommunicationState::HEARTBEAT);
+    m_stream_valid = m_stream->write(SerializeMessage(msg));
+    return false;
+  }
 
-    case cogmentAPI::CommunicationState::LAST_ACK: {
-      throw MakeException("Unexpected reception of communication state (LAST_ACK) from environment");
-    }
+  case cogmentAPI::CommunicationState::LAST: {
+    throw MakeException("Unexpected reception of communication state (LAST) from environment");
+  }
 
-    case cogmentAPI::CommunicationState::END: {
-      if (data_case == cogmentAPI::EnvRunTrialOutput::DataCase::kDetails) {
-        spdlog::error("Unexpected end of communication (END) from environment: [{}]", data.details());
-      }
-      else {
-        spdlog::error("Unexpected end of communication (END) from environment");
-      }
-      m_stream_valid = false;
-    }
+  case cogmentAPI::CommunicationState::LAST_ACK: {
+    throw MakeException("Unexpected reception of communication state (LAST_ACK) from environment");
+  }
 
-    default:
-      throw MakeException("Unknown communication state [{}] received from environment", static_cast<int>(state));
+  case cogmentAPI::CommunicationState::END: {
+    if (data_case == cogmentAPI::EnvRunTrialOutput::DataCase::kDetails) {
+      throw MakeException("Unexpected end of communication (END) from environment: [{}]", data.details());
+    }
+    else {
+      throw MakeException("Unexpected end of communication (END) from environment");
     }
   }
 
-  m_stream_valid = false;
+  default:
+    throw MakeException("Unknown communication state [{}] received from environment", static_cast<int>(state));
+  }
 }
 
 void Environment::process_incoming_state(cogmentAPI::CommunicationState in_state, const std::string* details) {
@@ -191,7 +206,7 @@ void Environment::process_incoming_state(cogmentAPI::CommunicationState in_state
       }
     }
     m_last_ack_received = true;
-    m_last_ack_prom.set_value();
+    m_last_ack.set();
     break;
 
   case cogmentAPI::CommunicationState::END:
@@ -270,61 +285,84 @@ void Environment::process_incoming_data(cogmentAPI::EnvRunTrialOutput&& data) {
   }
 }
 
-void Environment::process_incoming_stream() {
-  for (cogmentAPI::EnvRunTrialOutput data; m_stream_valid && m_stream->Read(&data); data.Clear()) {
+void Environment::process_incoming(cogmentAPI::EnvRunTrialOutput&& data) {
+  if (!m_init_completed) {
     try {
-      process_incoming_data(std::move(data));
+      if (process_init_data(std::move(data))) {
+        m_init_completed = true;
+        m_init_prom.set_value();
+        spdlog::debug("Trial [{}] - Environment [{}] init complete", m_trial->id(), m_name);
+      }
     }
     catch (const std::exception& exc) {
-      spdlog::error("Trial [{}] - Environment [{}] failed to process incoming data [{}]", m_trial->id(), m_name,
-                    exc.what());
+      spdlog::error("Trial [{}] - Environment [{}] failed to process stream [{}]", m_trial->id(), m_name, exc.what());
+      finish_stream();
+      m_stream->cancel();
     }
     catch (...) {
-      spdlog::error("Trial [{}] - Environment [{}] failed to process incoming data", m_trial->id(), m_name);
+      spdlog::error("Trial [{}] - Environment [{}] failed to process stream", m_trial->id(), m_name);
+      finish_stream();
+      m_stream->cancel();
     }
+
+    return;
+  }
+
+  try {
+    process_incoming_data(std::move(data));
+  }
+  catch (const std::exception& exc) {
+    spdlog::error("Trial [{}] - Environment [{}] failed to process incoming data [{}]", m_trial->id(), m_name,
+                  exc.what());
+  }
+  catch (...) {
+    spdlog::error("Trial [{}] - Environment [{}] failed to process incoming data", m_trial->id(), m_name);
   }
-  SPDLOG_DEBUG("Trial [{}] - Environment [{}] finished reading stream (valid [{}])", m_trial->id(), m_name,
-               m_stream_valid);
 }
 
-void Environment::run(std::unique_ptr<StreamType> stream) {
+void Environment::run() {
   SPDLOG_TRACE("Trial [{}] - Environment [{}] run", m_trial->id(), m_name);
 
   if (m_stream != nullptr) {
     throw MakeException("Environment already running");
   }
-  m_stream = std::move(stream);
+
+  std::unique_ptr<StreamType::CallType> call;
+  if (m_opened_stream != nullptr) {
+    m_stream = std::move(m_opened_stream);
+  }
+  else {
+    m_stream = StreamType::make(&m_trial->client_engine());
+    m_stream->context()->AddMetadata("trial-id", m_trial->id());
+    call = m_stub_entry->get_generic_stub().PrepareCall(m_stream->context(), RUN_TRIAL_METHOD, m_stream->queue());
+  }
   m_stream_valid = true;
 
   dispatch_init_data();
 
-  m_incoming_thread = m_trial->thread_pool().push("Environment incoming data", [this]() {
-    try {
-      read_init_data();
-
-      if (m_stream_valid) {
-        m_init_prom.set_value();
-        m_init_completed = true;
-        spdlog::debug("Trial [{}] - Environment [{}] init complete", m_trial->id(), m_name);
-      }
-
-      process_incoming_stream();
-    }
-    catch (const std::exception& exc) {
-      spdlog::error("Trial [{}] - Environment [{}] failed to process stream [{}]", m_trial->id(), m_name, exc.what());
-    }
-    catch (...) {
-      spdlog::error("Trial [{}] - Environment [{}] failed to process stream", m_trial->id(), m_name);
-    }
-
+  auto on_read = [this](grpc::ByteBuffer&& buffer) {
+    cogmentAPI::EnvRunTrialOutput data;
+    DeserializeMessage(&buffer, &data);
+    process_incoming(std::move(data));
+  };
+  auto on_done = [this](const grpc::Status&) {
+    SPDLOG_DEBUG("Trial [{}] - Environment [{}] finished reading stream (valid [{}])", m_trial->id(), m_name,
+                 m_stream_valid.load());
     finish_stream();
-  });
+  };
+
+  if (call != nullptr) {
+    m_stream->start(std::move(call), std::move(on_read), std::move(on_done));
+  }
+  else {
+    m_stream->start(std::move(on_read), std::move(on_done));
+  }
 }
 
 std::future<void> Environment::init() {
   SPDLOG_TRACE("Trial [{}] - Environment::init(): [{}]", m_trial->id(), m_name);
 
-  run(m_stub_entry->get_stub().RunTrial(&m_context));
+  run();
 
   return m_init_prom.get_future();
 }
@@ -346,29 +384,23 @@ void Environment::dispatch_init_data() {
     env_actor->set_actor_class(actor->actor_class());
   }
 
-  write_to_stream(std::move(msg));
+  write_to_stream(msg);
 }
 
-void Environment::dispatch_actions(cogmentAPI::ActionSet&& set, bool last) {
+void Environment::dispatch_actions(const std::function<void(cogmentAPI::ActionSet*)>& build_set, bool last) {
   if (last) {
     cogmentAPI::EnvRunTrialInput msg;
     msg.set_state(cogmentAPI::CommunicationState::LAST);
-    write_to_stream(std::move(msg));
+    write_to_stream(msg);
     SPDLOG_DEBUG("Trial [{}] - Environment [{}] 'LAST' sent", m_trial->id(), m_name);
     m_last_sent_received = true;
   }
 
-  cogmentAPI::EnvRunTrialInput msg;
-  msg.set_state(cogmentAPI::CommunicationState::NORMAL);
-  *(msg.mutable_action_set()) = std::move(set);
-  write_to_stream(std::move(msg));
-}
-
-void Environment::dispatch_message(cogmentAPI::Message&& message) {
-  cogmentAPI::EnvRunTrialInput msg;
-  msg.set_state(cogmentAPI::CommunicationState::NORMAL);
-  *(msg.mutable_message()) = std::move(message);
-  write_to_stream(std::move(msg));
+  auto arena = m_trial->acquire_arena();
+  auto msg = arena.create<cogmentAPI::EnvRunTrialInput>();
+  msg->set_state(cogmentAPI::CommunicationState::NORMAL);
+  build_set(msg->mutable_action_set());
+  write_to_stream(*msg);
 }
 
 void Environment::trial_ended(std::string_view details) {
@@ -383,26 +415,14 @@ void Environment::trial_ended(std::string_view details) {
     msg.set_details(details.data(), details.size());
   }
 
-  write_to_stream(std::move(msg));
+  m_stream_valid = m_stream->write_last(SerializeMessage(msg));
   SPDLOG_DEBUG("Trial [{}] - Environment [{}] 'END' sent", m_trial->id(), m_name);
 
-  const std::lock_guard lg(m_writing);
-  if (m_stream_valid) {
-    try {
-      m_stream_valid = m_stream->WritesDone();
-    }
-    catch (...) {
-      m_stream_valid = false;
-      throw;
-    }
-  }
-
   finish_stream();
 }
 
 void Environment::finish_stream() {
-  // m_stream->Finish();  // This seems to cause a crash in grpc
-
+  // The call itself will finish when the environment closes its side of the stream
   m_stream_valid = false;
 }
 
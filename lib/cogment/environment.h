@@ -15,6 +15,7 @@
 #ifndef COGMENT_ORCHESTRATOR_ENVIRONMENT_H
 #define COGMENT_ORCHESTRATOR_ENVIRONMENT_H
 
+#include "cogment/async_client.h"
 #include "cogment/stub_pool.h"
 
 #include "grpc++/grpc++.h"
@@ -22,6 +23,8 @@
 #include "cogment/api/environment.grpc.pb.h"
 #include "cogment/api/common.pb.h"
 
+#include <atomic>
+#include <functional>
 #include <vector>
 #include <future>
 
@@ -30,38 +33,43 @@ namespace cogment {
 class Trial;
 
 class Environment {
+public:
   using StubEntryType = std::shared_ptr<StubPool<cogmentAPI::EnvironmentSP>::Entry>;
-  using StreamType = grpc::ClientReaderWriter<cogmentAPI::EnvRunTrialInput, cogmentAPI::EnvRunTrialOutput>;
+  using StreamType = AsyncClientStream<grpc::ByteBuffer, grpc::ByteBuffer>;
 
-public:
-  Environment(Trial* owner, const cogmentAPI::EnvironmentParams& params, StubEntryType stub_entry);
+  // Opens a stream in advance for a trial (see `opened_stream` of the constructor)
+  static std::shared_ptr<StreamType> open_stream(ClientEngine* engine, const StubEntryType& stub_entry,
+                                                 const std::string& trial_id);
+
+  // If not null, `opened_stream` is used instead of opening a new stream (it must be for the same trial)
+  Environment(Trial* owner, const cogmentAPI::EnvironmentParams& params, StubEntryType stub_entry,
+              std::shared_ptr<StreamType> opened_stream = nullptr);
   ~Environment();
 
   std::future<void> init();
-  std::future<void> last_ack() { return m_last_ack_prom.get_future(); }
+  OneShotSignal& last_ack() { return m_last_ack; }
   void trial_ended(std::string_view details);
 
   const std::string& name() const { return m_name; }
 
-  void dispatch_actions(cogmentAPI::ActionSet&& msg, bool last);
+  // The action set is built (by `build_set`) on an arena in the calling thread
+  void dispatch_actions(const std::function<void(cogmentAPI::ActionSet*)>& build_set, bool last);
   void send_message(const cogmentAPI::Message& message, uint64_t tick_id);
 
 private:
-  void read_init_data();
+  bool process_init_data(cogmentAPI::EnvRunTrialOutput&& data);
   void dispatch_init_data();
-  void write_to_stream(cogmentAPI::EnvRunTrialInput&& data);
+  void write_to_stream(const cogmentAPI::EnvRunTrialInput& data);
   void process_incoming_state(cogmentAPI::CommunicationState in_state, const std::string* details);
   void process_incoming_data(cogmentAPI::EnvRunTrialOutput&& data);
-  void process_incoming_stream();
-  void run(std::unique_ptr<StreamType> stream);
-  void dispatch_message(cogmentAPI::Message&& message);
+  void process_incoming(cogmentAPI::EnvRunTrialOutput&& data);
+  void run();
   void finish_stream();
 
   StubEntryType m_stub_entry;
-  std::unique_ptr<StreamType> m_stream;
-  bool m_stream_valid;
-  grpc::ClientContext m_context;
-  std::mutex m_writing;
+  std::shared_ptr<StreamType> m_opened_stream;
+  std::shared_ptr<StreamType> m_stream;
+  std::atomic_bool m_stream_valid;
 
   Trial* const m_trial;
   const std::string m_name;
@@ -70,13 +78,11 @@ private:
   bool m_has_config;
 
   bool m_init_completed;
-  std::future<void> m_incoming_thread;
-
   std::promise<void> m_init_prom;
 
   bool m_last_sent_received;
   bool m_last_ack_received;
-  std::promise<void> m_last_ack_prom;
+  OneShotSignal m_last_ack;
 };
 
 }  // namespace cogment
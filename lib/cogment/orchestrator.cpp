@@ -26,24 +26,29 @@
 
 namespace {
 uuids::uuid_system_generator g_uuid_generator;
+
+constexpr uint32_t MIN_NB_BUFFERED_SAMPLES = 2;  // Because of the way trials use the buffer
+constexpr uint32_t DEFAULT_NB_BUFFERED_SAMPLES = 5;
+constexpr uint32_t DEFAULT_LOG_BATCH_SIZE = 1;
 }  // namespace
 
 namespace cogment {
-Orchestrator::Orchestrator(cogmentAPI::TrialParams default_trial_params, uint32_t gc_frequency,
+Orchestrator::Orchestrator(cogmentAPI::TrialParams default_trial_params,
                            std::shared_ptr<grpc::ChannelCredentials> creds, prometheus::Registry* metrics_registry) :
     m_default_trial_params(std::move(default_trial_params)),
-    m_gc_frequency(gc_frequency),
+    m_nb_buffered_samples(DEFAULT_NB_BUFFERED_SAMPLES),
+    m_log_batch_size(DEFAULT_LOG_BATCH_SIZE),
+    m_prehook_async(false),
+    m_tick_bundling(false),
+    m_action_deadline(0),
+    m_client_engine(0),
     m_channel_pool(creds),
     m_hook_stubs(&m_channel_pool),
     m_log_stubs(&m_channel_pool),
     m_env_stubs(&m_channel_pool),
-    m_agent_stubs(&m_channel_pool),
-    m_gc_countdown(gc_frequency) {
+    m_agent_stubs(&m_channel_pool) {
   SPDLOG_TRACE("Orchestrator()");
 
-  // TODO: Transform this into a "garbage collection" thread so the gc could
-  //       also be triggered by time, in order to prevent old ended
-  //       or stale trials from lingering if no new trials are started.
   m_delete_thread_fut = thread_pool().push("Orchestrator trial deletion", [this]() {
     while (true) {
       try {  // overkill
@@ -63,6 +68,7 @@ Orchestrator::Orchestrator(cogmentAPI::TrialParams default_trial_params, uint32_
     }
   });
 
+  prometheus::Family<prometheus::Summary>* prehook_family = nullptr;
   if (metrics_registry != nullptr) {
     auto& trial_family = prometheus::BuildSummary()
                              .Name("orchestrator_trial_duration_seconds")
@@ -81,17 +87,220 @@ Orchestrator::Orchestrator(cogmentAPI::TrialParams default_trial_params, uint32_
                           .Help("Duration (in seconds) of a trial garbage collection call")
                           .Register(*metrics_registry);
     m_gc_metrics = &(gc_family.Add({}, prometheus::Summary::Quantiles()));
+
+    auto& tick_arena_family = prometheus::BuildSummary()
+                                  .Name("orchestrator_tick_arena_heap_blocks")
+                                  .Help("Number of heap blocks allocated by arenas for a normal step")
+                                  .Register(*metrics_registry);
+    m_tick_arena_metrics = &(tick_arena_family.Add({}, prometheus::Summary::Quantiles()));
+
+    auto& actor_flushes_family = prometheus::BuildSummary()
+                                     .Name("orchestrator_actor_flushes_per_tick")
+                                     .Help("Number of writes sent to the network per actor for each tick")
+                                     .Register(*metrics_registry);
+    m_actor_flushes_metrics = &(actor_flushes_family.Add({}, prometheus::Summary::Quantiles()));
+
+    m_observation_dispatch_family =
+        &(prometheus::BuildSummary()
+              .Name("orchestrator_tick_observation_dispatch_seconds")
+              .Help("Time (in seconds) from the reception of observations to their dispatch to all actors")
+              .Register(*metrics_registry));
+    m_actor_action_family = &(prometheus::BuildSummary()
+                                  .Name("orchestrator_tick_actor_action_seconds")
+                                  .Help("Time (in seconds) from the dispatch of observations to the action of an actor")
+                                  .Register(*metrics_registry));
+    m_action_dispatch_family =
+        &(prometheus::BuildSummary()
+              .Name("orchestrator_tick_action_dispatch_seconds")
+              .Help("Time (in seconds) from the last action of a tick to the actions written to the environment")
+              .Register(*metrics_registry));
+    m_sample_cycle_family = &(prometheus::BuildSummary()
+                                  .Name("orchestrator_tick_sample_cycle_seconds")
+                                  .Help("Time (in seconds) spent cycling the trial samples to the datalog for a tick")
+                                  .Register(*metrics_registry));
+
+    auto& late_actions_family = prometheus::BuildCounter()
+                                    .Name("orchestrator_late_actions_total")
+                                    .Help("Number of actions received after their deadline (and dropped)")
+                                    .Register(*metrics_registry);
+    m_late_actions_metrics = &(late_actions_family.Add({}));
+
+    auto& defaulted_actions_family = prometheus::BuildCounter()
+                                         .Name("orchestrator_defaulted_actions_total")
+                                         .Help("Number of default actions used for late or disconnected actors")
+                                         .Register(*metrics_registry);
+    m_defaulted_actions_metrics = &(defaulted_actions_family.Add({}));
+
+    auto& actor_queue_depth_family = prometheus::BuildGauge()
+                                         .Name("orchestrator_actor_queue_depth")
+                                         .Help("Number of writes waiting to be sent to client actors")
+                                         .Register(*metrics_registry);
+    auto& actor_write_family = prometheus::BuildSummary()
+                                   .Name("orchestrator_actor_write_seconds")
+                                   .Help("Time (in seconds) to send a queued write to a client actor")
+                                   .Register(*metrics_registry);
+    auto& actor_lag_family = prometheus::BuildSummary()
+                                 .Name("orchestrator_actor_lag_seconds")
+                                 .Help("Time (in seconds) writes wait in the queue before being sent to a client actor")
+                                 .Register(*metrics_registry);
+    auto& actor_overflows_family = prometheus::BuildCounter()
+                                       .Name("orchestrator_actor_queue_overflows_total")
+                                       .Help("Number of client actors disconnected because their write queue was full")
+                                       .Register(*metrics_registry);
+    auto& actor_queue_metrics = m_actor_queue_options.metrics;
+    actor_queue_metrics.depth = &actor_queue_depth_family;
+    actor_queue_metrics.write_time = &actor_write_family;
+    actor_queue_metrics.lag = &actor_lag_family;
+    actor_queue_metrics.overflows = &actor_overflows_family;
+
+    auto& arena_leases_family = prometheus::BuildCounter()
+                                    .Name("orchestrator_arena_leases_total")
+                                    .Help("Number of times an arena was used to build messages")
+                                    .Register(*metrics_registry);
+    auto& arena_blocks_family = prometheus::BuildCounter()
+                                    .Name("orchestrator_arena_heap_blocks_total")
+                                    .Help("Number of heap blocks allocated by arenas")
+                                    .Register(*metrics_registry);
+    m_arena_pool = std::make_unique<ArenaPool>(
+        ArenaPool::Metrics {&(arena_leases_family.Add({})), &(arena_blocks_family.Add({}))});
+
+    auto& datalog_depth_family = prometheus::BuildGauge()
+                                     .Name("orchestrator_datalog_queue_depth")
+                                     .Help("Number of samples waiting to be sent to datalogs")
+                                     .Register(*metrics_registry);
+    auto& datalog_lag_family = prometheus::BuildSummary()
+                                   .Name("orchestrator_datalog_lag_seconds")
+                                   .Help("Time (in seconds) samples wait in the queue before being sent to the datalog")
+                                   .Register(*metrics_registry);
+    auto& datalog_dropped_family = prometheus::BuildCounter()
+                                       .Name("orchestrator_datalog_dropped_samples_total")
+                                       .Help("Number of samples that could not be sent to the datalog")
+                                       .Register(*metrics_registry);
+    auto& datalog_held_overflow_family =
+        prometheus::BuildCounter()
+            .Name("orchestrator_datalog_held_overflow_total")
+            .Help("Number of samples dropped because the 'block' overflow policy was holding back too many samples")
+            .Register(*metrics_registry);
+    auto& datalog_metrics = m_datalog_queue_options.metrics;
+    datalog_metrics.depth = &(datalog_depth_family.Add({}));
+    datalog_metrics.lag = &(datalog_lag_family.Add({}, prometheus::Summary::Quantiles()));
+    datalog_metrics.dropped = &(datalog_dropped_family.Add({}));
+    datalog_metrics.held_overflow = &(datalog_held_overflow_family.Add({}));
+
+    auto& compression_ratio_family = prometheus::BuildSummary()
+                                         .Name("orchestrator_datalog_compression_ratio")
+                                         .Help("Ratio of uncompressed to compressed size of datalog file blocks")
+                                         .Register(*metrics_registry);
+    auto& compression_time_family = prometheus::BuildCounter()
+                                        .Name("orchestrator_datalog_compression_seconds_total")
+                                        .Help("CPU time (in seconds) spent compressing datalog file blocks")
+                                        .Register(*metrics_registry);
+    m_datalog_file_metrics.compression_ratio =
+        &(compression_ratio_family.Add({}, prometheus::Summary::Quantiles()));
+    m_datalog_file_metrics.compression_seconds = &(compression_time_family.Add({}));
+
+    auto& registry_contention_family = prometheus::BuildCounter()
+                                           .Name("orchestrator_trial_registry_contentions_total")
+                                           .Help("Number of times the trial registry was locked by another thread")
+                                           .Register(*metrics_registry);
+    auto& registry_wait_family = prometheus::BuildCounter()
+                                     .Name("orchestrator_trial_registry_wait_seconds_total")
+                                     .Help("Time (in seconds) spent waiting for the trial registry locks")
+                                     .Register(*metrics_registry);
+    m_trials = std::make_unique<TrialRegistry>(
+        TrialRegistry::Metrics {&(registry_contention_family.Add({})), &(registry_wait_family.Add({}))});
+
+    prehook_family = &(prometheus::BuildSummary()
+                           .Name("orchestrator_pre_trial_hook_duration_seconds")
+                           .Help("Duration (in seconds) of pre-trial hook calls")
+                           .Register(*metrics_registry));
+
+    auto& prehook_hits_family = prometheus::BuildCounter()
+                                    .Name("orchestrator_pre_trial_hook_cache_hits_total")
+                                    .Help("Number of pre-trial hook results found in the cache")
+                                    .Register(*metrics_registry);
+    auto& prehook_misses_family = prometheus::BuildCounter()
+                                      .Name("orchestrator_pre_trial_hook_cache_misses_total")
+                                      .Help("Number of pre-trial hook results not found in the cache")
+                                      .Register(*metrics_registry);
+    m_prehook_cache_metrics.hits = &(prehook_hits_family.Add({}));
+    m_prehook_cache_metrics.misses = &(prehook_misses_family.Add({}));
+
+    auto& warm_size_family = prometheus::BuildGauge()
+                                 .Name("orchestrator_warm_trials")
+                                 .Help("Number of trials with connections opened in advance")
+                                 .Register(*metrics_registry);
+    auto& warm_hits_family = prometheus::BuildCounter()
+                                 .Name("orchestrator_warm_trial_hits_total")
+                                 .Help("Number of trials started with connections opened in advance")
+                                 .Register(*metrics_registry);
+    auto& warm_misses_family = prometheus::BuildCounter()
+                                   .Name("orchestrator_warm_trial_misses_total")
+                                   .Help("Number of trials started without a matching warm trial available")
+                                   .Register(*metrics_registry);
+    m_warm_pool_metrics.size = &(warm_size_family.Add({}));
+    m_warm_pool_metrics.hits = &(warm_hits_family.Add({}));
+    m_warm_pool_metrics.misses = &(warm_misses_family.Add({}));
+
+    auto& channel_streams_family = prometheus::BuildGauge()
+                                       .Name("orchestrator_connection_streams")
+                                       .Help("Number of streams using each connection to an endpoint")
+                                       .Register(*metrics_registry);
+    m_channel_pool.set_metrics(&channel_streams_family);
+
+    auto& warm_up_family = prometheus::BuildSummary()
+                               .Name("orchestrator_connection_warm_up_seconds")
+                               .Help("Time (in seconds) to connect to known endpoints at startup")
+                               .Register(*metrics_registry);
+    auto& warm_up_failures_family = prometheus::BuildCounter()
+                                        .Name("orchestrator_connection_warm_up_failures_total")
+                                        .Help("Number of connections that could not be established at startup")
+                                        .Register(*metrics_registry);
+    m_warm_up_metrics = &(warm_up_family.Add({}, prometheus::Summary::Quantiles()));
+    m_warm_up_failures = &(warm_up_failures_family.Add({}));
   }
   else {
     m_trials_metrics = nullptr;
     m_ticks_metrics = nullptr;
     m_gc_metrics = nullptr;
+    m_tick_arena_metrics = nullptr;
+    m_actor_flushes_metrics = nullptr;
+    m_late_actions_metrics = nullptr;
+    m_observation_dispatch_family = nullptr;
+    m_actor_action_family = nullptr;
+    m_action_dispatch_family = nullptr;
+    m_sample_cycle_family = nullptr;
+    m_defaulted_actions_metrics = nullptr;
+    m_warm_up_metrics = nullptr;
+    m_warm_up_failures = nullptr;
+    m_arena_pool = std::make_unique<ArenaPool>(ArenaPool::Metrics {});
+    m_trials = std::make_unique<TrialRegistry>(TrialRegistry::Metrics {});
   }
+
+  auto delete_func = [this](std::shared_ptr<Trial>&& trial) {
+    m_trials_to_delete.push(std::move(trial));
+  };
+  m_prehooks = std::make_unique<PreTrialHooks>(&m_client_engine, prehook_family);
+  m_timers = std::make_unique<TimerWheel>(&m_thread_pool);
+  m_collector = std::make_unique<TrialCollector>(m_trials.get(), m_timers.get(), &m_thread_pool,
+                                                 std::move(delete_func), m_gc_metrics);
 }
 
 Orchestrator::~Orchestrator() {
   SPDLOG_TRACE("~Orchestrator()");
 
+  if (m_warm_up_fut.valid()) {
+    m_warm_up_fut.wait();
+  }
+
+  m_prehooks.reset();
+  m_warm_pool.reset();
+
+  // The timers may refer to the collector, so they are stopped first. The wheel itself is kept: the
+  // remaining trials and the client engine handlers still use it (it is destroyed after them).
+  m_timers->stop();
+  m_collector.reset();
+
   {
     const std::lock_guard lg(m_notification_lock);
     for (auto& watcher : m_trial_watchers) {
@@ -105,137 +314,389 @@ Orchestrator::~Orchestrator() {
 
 std::shared_ptr<Trial> Orchestrator::start_trial(cogmentAPI::TrialParams params, const std::string& user_id,
                                                  std::string trial_id_req) {
+  std::unique_ptr<WarmTrial> warm_trial;
   if (trial_id_req.empty()) {
-    trial_id_req.assign(to_string(g_uuid_generator()));
+    if (m_warm_pool != nullptr) {
+      warm_trial = m_warm_pool->take(params);
+    }
+
+    if (warm_trial != nullptr) {
+      trial_id_req.assign(warm_trial->trial_id());
+    }
+    else {
+      trial_id_req.assign(to_string(g_uuid_generator()));
+    }
   }
   else {
     // We pre-check the uniqueness to save some processing.
-    const std::lock_guard lg(m_trials_mutex);
-    if (m_trials.find(trial_id_req) != m_trials.end()) {
+    if (m_trials->contains(trial_id_req)) {
       return nullptr;
     }
   }
 
+  const Trial::Metrics trial_metrics {m_trials_metrics,
+                                      m_ticks_metrics,
+                                      m_tick_arena_metrics,
+                                      m_actor_flushes_metrics,
+                                      m_late_actions_metrics,
+                                      m_defaulted_actions_metrics,
+                                      m_observation_dispatch_family,
+                                      m_actor_action_family,
+                                      m_action_dispatch_family,
+                                      m_sample_cycle_family};
+  auto new_trial = Trial::make(this, user_id, trial_id_req, trial_metrics);
+  new_trial->set_warm_connections(std::move(warm_trial));
+
+  // Register the trial
+  if (!m_trials->insert(new_trial->id(), new_trial)) {
+    return nullptr;
+  }
+
+  if (m_prehook_async && m_prehooks->size() > 0) {
+    // The trial id is returned right away, the trial will start when the hooks are done
+    m_prehooks->run(std::move(params), new_trial->id(), user_id,
+                    [this, new_trial](cogmentAPI::TrialParams&& final_params, const std::string& error) {
+                      if (!error.empty()) {
+                        spdlog::error("Trial [{}] - Pre-trial hook failure [{}]", new_trial->id(), error);
+                        new_trial->terminate("Pre-trial hook failure");
+                        return;
+                      }
+
+                      m_thread_pool.push("Trial start after pre-hooks",
+                                         [this, new_trial, final_params = std::move(final_params)]() mutable {
+                                           m_start_hooked_trial(new_trial, std::move(final_params));
+                                         });
+                    });
+    return new_trial;
+  }
+
+  cogmentAPI::TrialParams final_params;
   try {
-    m_perform_trial_gc();
+    final_params = m_perform_pre_hooks(std::move(params), new_trial->id(), user_id);
+  }
+  catch (...) {
+    new_trial->terminate("Pre-trial hook failure");
+    throw;
+  }
+
+  new_trial->start(std::move(final_params));
+  m_collector->watch(new_trial);
+  spdlog::info("Trial [{}] successfully initialized", new_trial->id());
+
+  return new_trial;
+}
+
+bool Orchestrator::m_start_hooked_trial(const std::shared_ptr<Trial>& trial, cogmentAPI::TrialParams&& params) {
+  try {
+    if (trial->state() != Trial::InternalState::initializing) {
+      spdlog::debug("Trial [{}] - Ended before the end of its pre-trial hooks", trial->id());
+      return false;
+    }
+
+    trial->start(std::move(params));
+    m_collector->watch(trial);
+    spdlog::info("Trial [{}] successfully initialized", trial->id());
+    return true;
   }
   catch (const std::exception& exc) {
-    spdlog::error("Failure to perform garbage collection of trials [{}]", exc.what());
+    spdlog::error("Trial [{}] - Failed to start [{}]", trial->id(), exc.what());
+    trial->terminate("Failed to start");
   }
   catch (...) {
-    spdlog::error("Failure to perform garbage collection of trials");
+    spdlog::error("Trial [{}] - Failed to start", trial->id());
+    trial->terminate("Failed to start");
   }
 
-  auto new_trial = Trial::make(this, user_id, trial_id_req, Trial::Metrics {m_trials_metrics, m_ticks_metrics});
+  return false;
+}
+
+void Orchestrator::start_trials(std::vector<StartRequest>&& requests, StartedHandler handler) {
+  auto shared_handler = std::make_shared<StartedHandler>(std::move(handler));
+
+  const Trial::Metrics trial_metrics {m_trials_metrics,
+                                      m_ticks_metrics,
+                                      m_tick_arena_metrics,
+                                      m_actor_flushes_metrics,
+                                      m_late_actions_metrics,
+                                      m_defaulted_actions_metrics,
+                                      m_observation_dispatch_family,
+                                      m_actor_action_family,
+                                      m_action_dispatch_family,
+                                      m_sample_cycle_family};
+  std::vector<std::pair<std::string, std::shared_ptr<Trial>>> new_trials;
+  new_trials.reserve(requests.size());
+  for (auto& request : requests) {
+    std::unique_ptr<WarmTrial> warm_trial;
+    if (request.trial_id_req.empty()) {
+      if (m_warm_pool != nullptr) {
+        warm_trial = m_warm_pool->take(request.params);
+      }
 
-  // Register the trial
-  {
-    const std::lock_guard lg(m_trials_mutex);
-    auto [itor, inserted] = m_trials.emplace(new_trial->id(), new_trial);
-    if (!inserted) {
-      return nullptr;
+      if (warm_trial != nullptr) {
+        request.trial_id_req.assign(warm_trial->trial_id());
+      }
+      else {
+        request.trial_id_req.assign(to_string(g_uuid_generator()));
+      }
     }
+    auto trial = Trial::make(this, request.user_id, request.trial_id_req, trial_metrics);
+    trial->set_warm_connections(std::move(warm_trial));
+    new_trials.emplace_back(trial->id(), std::move(trial));
   }
 
-  auto final_param = m_perform_pre_hooks(std::move(params), new_trial->id(), user_id);
+  const auto inserted = m_trials->insert_batch(new_trials);
 
-  new_trial->start(std::move(final_param));
-  spdlog::info("Trial [{}] successfully initialized", new_trial->id());
+  // Identical requests are grouped to make a single pre-trial hook call (when the result can come from the cache)
+  const bool share_hooks = (m_prehooks->size() > 0 && m_prehooks->caching());
+  std::vector<std::vector<size_t>> groups;
+  std::unordered_map<std::string, size_t> group_indexes;
+  for (size_t index = 0; index < requests.size(); index++) {
+    if (!inserted[index]) {
+      (*shared_handler)(index, {}, "Trial id already in use");
+      continue;
+    }
 
-  return new_trial;
-}
+    if (share_hooks) {
+      auto key = requests[index].user_id;
+      key.push_back('\0');
+      append_deterministic(&key, requests[index].params);
+
+      auto [itor, is_new] = group_indexes.emplace(std::move(key), groups.size());
+      if (!is_new) {
+        groups[itor->second].push_back(index);
+        continue;
+      }
+    }
+    groups.push_back({index});
+  }
 
-void Orchestrator::add_prehook(const std::string& url) { m_prehooks.push_back(m_hook_stubs.get_stub_entry(url)); }
+  // Starts a trial of the batch with the result of its pre-trial hooks
+  auto start_hooked = [this, shared_handler](size_t index, const std::shared_ptr<Trial>& trial,
+                                             cogmentAPI::TrialParams&& final_params, const std::string& error) {
+    if (!error.empty()) {
+      spdlog::error("Trial [{}] - Pre-trial hook failure [{}]", trial->id(), error);
+      trial->terminate("Pre-trial hook failure");
+      (*shared_handler)(index, {}, error);
+      return;
+    }
 
-cogmentAPI::TrialParams Orchestrator::m_perform_pre_hooks(cogmentAPI::TrialParams&& params, const std::string& trial_id,
-                                                          const std::string& user_id) {
-  cogmentAPI::PreTrialParams hook_param;
+    m_thread_pool.push("Trial start in batch", [this, index, trial, final_params = std::move(final_params),
+                                               shared_handler]() mutable {
+      if (m_start_hooked_trial(trial, std::move(final_params))) {
+        (*shared_handler)(index, trial->id(), {});
+      }
+      else {
+        (*shared_handler)(index, {}, "Trial failed to start");
+      }
+    });
+  };
+
+  auto shared_requests = std::make_shared<std::vector<StartRequest>>(std::move(requests));
+  auto shared_trials = std::make_shared<decltype(new_trials)>(std::move(new_trials));
+  for (auto& group : groups) {
+    // The other members of the group go through the hooks after the first one is done, so they get
+    // its result from the cache (if the reply could be cached; otherwise they make their own calls).
+    // If the first one failed (or was cancelled), they fail the same way.
+    auto followers = [this, group, shared_requests, shared_trials, start_hooked](const std::string& first_error) {
+      for (size_t pos = 1; pos < group.size(); pos++) {
+        const size_t index = group[pos];
+        auto& request = (*shared_requests)[index];
+        auto trial = (*shared_trials)[index].second;
+        if (!first_error.empty()) {
+          start_hooked(index, trial, cogmentAPI::TrialParams(), first_error);
+          continue;
+        }
+
+        m_prehooks->run(std::move(request.params), trial->id(), request.user_id,
+                        [index, trial, start_hooked](cogmentAPI::TrialParams&& final_params,
+                                                     const std::string& error) {
+                          start_hooked(index, trial, std::move(final_params), error);
+                        });
+      }
+    };
+
+    const size_t index = group.front();
+    auto& request = (*shared_requests)[index];
+    auto trial = (*shared_trials)[index].second;
+    m_prehooks->run(std::move(request.params), trial->id(), request.user_id,
+                    [index, trial, start_hooked, followers](cogmentAPI::TrialParams&& final_params,
+                                                            const std::string& error) {
+                      start_hooked(index, trial, std::move(final_params), error);
+                      followers(error);
+                    });
+  }
+}
 
-  *hook_param.mutable_params() = std::move(params);
-  for (auto& hook : m_prehooks) {
-    grpc::ClientContext hook_context;
-    hook_context.AddMetadata("trial-id", trial_id);
-    hook_context.AddMetadata("user-id", user_id);
+void Orchestrator::add_prehook(const std::string& url) {
+  std::unordered_map<std::string, std::string> query;
+  const auto base_url = split_url_query(url, &query);
 
-    auto status = hook->get_stub().OnPreTrial(&hook_context, hook_param, &hook_param);
-    if (!status.ok()) {
-      throw MakeException("Pre-trial hook failure [{}]", status.error_message());
+  uint32_t timeout = 0;
+  auto timeout_itor = query.find("timeout");
+  if (timeout_itor != query.end()) {
+    try {
+      timeout = static_cast<uint32_t>(std::stoul(timeout_itor->second));
+    }
+    catch (...) {
+      throw MakeException("Invalid pre-trial hook timeout [{}] for [{}]", timeout_itor->second, base_url);
     }
   }
 
-  return std::move(*hook_param.mutable_params());
+  m_prehooks->add(m_hook_stubs.get_stub_entry(base_url), base_url, timeout);
+  m_prehook_urls.emplace_back(base_url);
 }
 
-void Orchestrator::m_perform_trial_gc() {
-  m_gc_countdown--;
-  if (m_gc_countdown != 0) {
-    return;
+std::shared_future<void> Orchestrator::warm_up_connections(uint32_t timeout) {
+  if (m_warm_up_fut.valid()) {
+    throw MakeException("Connections already warmed up");
   }
-  m_gc_countdown.store(m_gc_frequency);
 
-  const auto start = Timestamp();
+  std::vector<std::string> urls;
+  auto add_url = [&urls](const std::string& url) {
+    std::unordered_map<std::string, std::string> query;
+    const auto base_url = split_url_query(url, &query);
+    if (base_url.find("grpc://") != 0) {
+      return;  // Not a remote service (e.g. client actor or file datalog)
+    }
 
-  spdlog::debug("Performing garbage collection of ended and stale trials");
-  std::vector<std::shared_ptr<Trial>> stale_trials;
+    auto real_url = base_url.substr(7);
+    if (std::find(urls.begin(), urls.end(), real_url) == urls.end()) {
+      urls.emplace_back(std::move(real_url));
+    }
+  };
 
-  const std::lock_guard lg(m_trials_mutex);
+  add_url(m_default_trial_params.environment().endpoint());
+  for (const auto& actor : m_default_trial_params.actors()) {
+    add_url(actor.endpoint());
+  }
+  add_url(m_default_trial_params.datalog().endpoint());
+  for (const auto& url : m_prehook_urls) {
+    add_url(url);
+  }
 
-  auto itor = m_trials.begin();
-  while (itor != m_trials.end()) {
-    auto& trial = itor->second;
-    if (trial == nullptr) {
-      throw MakeException("Null trial stored in list");
+  // All connections of the endpoints are opened (they are selected in turn while held)
+  const size_t nb_connections = m_channel_pool.nb_connections();
+  for (const auto& url : urls) {
+    for (size_t count = 0; count < nb_connections; count++) {
+      auto conn = m_channel_pool.get_connection(url);
+      conn->channel()->GetState(true);  // Starts connecting
+      m_warm_up_connections.emplace_back(url, std::move(conn));
     }
+  }
 
-    if (trial->state() == Trial::InternalState::ended) {
-      m_trials_to_delete.push(std::move(trial));
-      itor = m_trials.erase(itor);
-    }
-    else if (trial->is_stale()) {
-      stale_trials.emplace_back(trial);
-      ++itor;
-    }
-    else {
-      ++itor;
+  spdlog::info("Warming up [{}] connections to [{}] endpoints", m_warm_up_connections.size(), urls.size());
+  const auto start = std::chrono::steady_clock::now();
+  const auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(timeout);
+
+  auto fut = m_thread_pool.push("Connection warm-up", [this, start, deadline]() {
+    size_t nb_failed = 0;
+    for (auto& [url, conn] : m_warm_up_connections) {
+      // The connections are established in parallel, so this is the time since the start of the warm-up
+      const bool connected = conn->channel()->WaitForConnected(deadline);
+      const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      if (connected) {
+        spdlog::debug("Connection [{}] to [{}] established in [{:.3f}] seconds", conn->index(), url, elapsed.count());
+        if (m_warm_up_metrics != nullptr) {
+          m_warm_up_metrics->Observe(elapsed.count());
+        }
+      }
+      else {
+        spdlog::warn("Connection [{}] to [{}] could not be established in time", conn->index(), url);
+        nb_failed++;
+        if (m_warm_up_failures != nullptr) {
+          m_warm_up_failures->Increment();
+        }
+      }
     }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    spdlog::info("Connection warm-up done in [{:.3f}] seconds ([{}] failed)", elapsed.count(), nb_failed);
+  });
+
+  m_warm_up_fut = fut.share();
+  return m_warm_up_fut;
+}
+
+void Orchestrator::set_sample_buffering(uint32_t nb_buffered_samples, uint32_t log_batch_size) {
+  if (nb_buffered_samples < MIN_NB_BUFFERED_SAMPLES) {
+    throw MakeException("Number of buffered samples must be at least [{}]: [{}]", MIN_NB_BUFFERED_SAMPLES,
+                        nb_buffered_samples);
   }
+  if (log_batch_size == 0) {
+    throw MakeException("Datalog batch size must be greater than 0");
+  }
+
+  m_nb_buffered_samples = nb_buffered_samples;
+  m_log_batch_size = log_batch_size;
+}
 
-  // Terminate may be long, so we don't want to lock the list during that time.
-  // We don't go as far as with the deleted trials (i.e. terminating in a different thread)
-  // because stale trials should be rare.
-  for (auto& trial : stale_trials) {
-    trial->terminate("The trial was inactive for too long");
+void Orchestrator::set_datalog_queue(uint32_t max_size, const std::string& overflow_policy) {
+  if (max_size == 0) {
+    throw MakeException("Datalog queue size must be greater than 0");
   }
 
-  if (m_gc_metrics != nullptr) {
-    const auto duration = Timestamp() - start;
-    m_gc_metrics->Observe(static_cast<double>(duration) * NANOS_INV);
+  m_datalog_queue_options.max_size = max_size;
+  m_datalog_queue_options.policy = DatalogQueue::policy_from_string(overflow_policy);
+}
+
+void Orchestrator::set_prehook_timeout(uint32_t seconds) { m_prehooks->set_default_timeout(seconds); }
+
+void Orchestrator::set_connections(uint32_t nb_per_endpoint, const std::string& selection) {
+  if (nb_per_endpoint == 0) {
+    throw MakeException("Number of connections per endpoint must be greater than 0");
   }
-  SPDLOG_TRACE("Garbage collection done");
+
+  m_channel_pool.set_connections(nb_per_endpoint, ChannelPool::selection_from_string(selection));
 }
 
-std::shared_ptr<Trial> Orchestrator::get_trial(const std::string& trial_id) const {
-  const std::lock_guard lg(m_trials_mutex);
-  auto itor = m_trials.find(trial_id);
-  if (itor != m_trials.end()) {
-    return itor->second;
+void Orchestrator::set_warm_trials(uint32_t nb_per_profile) {
+  if (nb_per_profile == 0) {
+    m_warm_pool.reset();
+    return;
   }
-  else {
-    return {};
+
+  m_warm_pool = std::make_unique<WarmTrialPool>(this, nb_per_profile, m_warm_pool_metrics);
+  m_warm_pool->add_profile(m_default_trial_params);
+}
+
+void Orchestrator::set_prehook_cache(uint32_t max_size, uint32_t ttl) {
+  m_prehooks->set_cache(std::make_unique<PreTrialHookCache>(max_size, ttl, m_prehook_cache_metrics));
+}
+
+cogmentAPI::TrialParams Orchestrator::m_perform_pre_hooks(cogmentAPI::TrialParams&& params, const std::string& trial_id,
+                                                          const std::string& user_id) {
+  if (m_prehooks->size() == 0) {
+    return std::move(params);
   }
+
+  // The hooks are asynchronous, only this (caller) thread waits for them
+  auto prom = std::make_shared<std::promise<cogmentAPI::TrialParams>>();
+  auto fut = prom->get_future();
+  m_prehooks->run(std::move(params), trial_id, user_id,
+                  [prom](cogmentAPI::TrialParams&& final_params, const std::string& error) {
+                    if (error.empty()) {
+                      prom->set_value(std::move(final_params));
+                    }
+                    else {
+                      prom->set_exception(std::make_exception_ptr(MakeException("Pre-trial hook failure [{}]", error)));
+                    }
+                  });
+
+  return fut.get();
 }
 
-std::vector<std::shared_ptr<Trial>> Orchestrator::all_trials() const {
-  const std::lock_guard lg(m_trials_mutex);
+std::shared_ptr<Trial> Orchestrator::get_trial(const std::string& trial_id) const {
+  return m_trials->find(trial_id);
+}
 
-  std::vector<std::shared_ptr<Trial>> result;
-  result.reserve(m_trials.size());
+std::vector<std::shared_ptr<Trial>> Orchestrator::all_trials() const { return m_trials->snapshot(); }
 
-  for (const auto& t : m_trials) {
-    result.push_back(t.second);
+void Orchestrator::trial_ended(const std::string& trial_id) {
+  // The collector is stopped first when the orchestrator is destroyed
+  if (m_collector != nullptr) {
+    m_collector->trial_ended(trial_id);
   }
-
-  return result;
 }
 
 std::future<void> Orchestrator::watch_trials(HandlerFunction func) {
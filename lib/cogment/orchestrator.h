@@ -15,17 +15,28 @@
 #ifndef COGMENT_ORCHESTRATOR_ORCHESTRATOR_H
 #define COGMENT_ORCHESTRATOR_ORCHESTRATOR_H
 
+#include "cogment/arena_pool.h"
+#include "cogment/async_client.h"
 #include "cogment/client_actor.h"
+#include "cogment/datalog.h"
+#include "cogment/datalog_queue.h"
+#include "cogment/pre_trial_hooks.h"
 #include "cogment/stub_pool.h"
+#include "cogment/timer_wheel.h"
 #include "cogment/trial.h"
+#include "cogment/trial_collector.h"
 #include "cogment/trial_params.h"
+#include "cogment/trial_registry.h"
 #include "cogment/utils.h"
+#include "cogment/warm_trial_pool.h"
 
 #include "cogment/api/hooks.grpc.pb.h"
 #include "cogment/api/datalog.grpc.pb.h"
 #include "cogment/api/agent.grpc.pb.h"
 #include "cogment/api/environment.grpc.pb.h"
 
+#include "prometheus/counter.h"
+#include "prometheus/gauge.h"
 #include "prometheus/registry.h"
 #include "prometheus/summary.h"
 
@@ -39,23 +50,86 @@ class Orchestrator {
 public:
   using HandlerFunction = std::function<bool(const Trial& trial)>;
 
-  Orchestrator(cogmentAPI::TrialParams default_trial_params, uint32_t gc_frequency,
-               std::shared_ptr<grpc::ChannelCredentials> creds, prometheus::Registry* metrics_registry);
+  struct StartRequest {
+    cogmentAPI::TrialParams params;
+    std::string user_id;
+    std::string trial_id_req;  // Generated if empty
+  };
+
+  // Called once per request (from any thread), when the trial is pending or could not be started.
+  // The trial id is empty if the trial could not be started.
+  using StartedHandler = std::function<void(size_t index, const std::string& trial_id, const std::string& error)>;
+
+  Orchestrator(cogmentAPI::TrialParams default_trial_params, std::shared_ptr<grpc::ChannelCredentials> creds,
+               prometheus::Registry* metrics_registry);
   ~Orchestrator();
 
   void Version(cogmentAPI::VersionInfo* out);
 
+  // The url can have a `timeout` query parameter (in seconds) for this hook
   void add_prehook(const std::string& url);
 
+  // Maximum time (in seconds) for each pre-trial hook call, 0 for no limit
+  void set_prehook_timeout(uint32_t seconds);
+
+  // If true, `start_trial` returns before the pre-trial hooks are done, and the trial starts when they are done
+  void set_prehook_async(bool async) { m_prehook_async = async; }
+
+  // Number of connections opened to each endpoint, and how they are selected for new streams
+  // ("least_loaded" or "round_robin"). Must be set before any connection is opened.
+  void set_connections(uint32_t nb_per_endpoint, const std::string& selection);
+
+  // Number of trials kept with their connections opened in advance, for each set of endpoints (0 to disable)
+  void set_warm_trials(uint32_t nb_per_profile);
+
+  // Number of pre-trial hook results kept for reuse (0 to disable), and how long (in seconds) they are valid
+  void set_prehook_cache(uint32_t max_size, uint32_t ttl);
+
+  // If true, the data sent to a service actor between ticks (rewards, messages, observation) is sent at once
+  void set_tick_bundling(bool bundling) { m_tick_bundling = bundling; }
+  bool tick_bundling() const { return m_tick_bundling; }
+
+  // Time (in milliseconds) given to the actors to act after an observation, before their default action is used
+  // (0 for no limit). Actors can have their own deadline with an `action_deadline` endpoint query parameter.
+  void set_action_deadline(uint32_t milliseconds) { m_action_deadline = milliseconds; }
+  uint32_t action_deadline() const { return m_action_deadline; }
+
+  // Maximum number of writes queued for each client actor (0 to write directly from the trial)
+  void set_actor_queue(uint32_t max_size) { m_actor_queue_options.max_size = max_size; }
+  const ActorQueueOptions& actor_queue_options() const { return m_actor_queue_options; }
+
+  // Number of samples kept in a trial before being sent to the datalog, and number sent at once
+  void set_sample_buffering(uint32_t nb_buffered_samples, uint32_t log_batch_size);
+  uint32_t nb_buffered_samples() const { return m_nb_buffered_samples; }
+  uint32_t log_batch_size() const { return m_log_batch_size; }
+
+  // Samples waiting to be sent to the datalog of a trial
+  void set_datalog_queue(uint32_t max_size, const std::string& overflow_policy);
+  const DatalogQueue::Options& datalog_queue_options() const { return m_datalog_queue_options; }
+  const DatalogServiceFile::Metrics& datalog_file_metrics() const { return m_datalog_file_metrics; }
+
+  // Opens all the connections to the grpc endpoints of the default parameters and pre-trial hooks,
+  // and keeps them open. The future is ready when they are all connected, or after `timeout` seconds.
+  std::shared_future<void> warm_up_connections(uint32_t timeout);
+
   std::shared_ptr<Trial> start_trial(cogmentAPI::TrialParams params, const std::string& user_id,
                                      std::string trial_id_req);
+
+  // The trials are registered together, and identical requests share their pre-trial hook calls
+  // if the hook results are cached. The function returns before the trials are started.
+  void start_trials(std::vector<StartRequest>&& requests, StartedHandler handler);
+
   std::shared_ptr<Trial> get_trial(const std::string& trial_id) const;
   std::vector<std::shared_ptr<Trial>> all_trials() const;
+  void trial_ended(const std::string& trial_id);
 
   StubPool<cogmentAPI::DatalogSP>* log_pool() { return &m_log_stubs; }
   StubPool<cogmentAPI::EnvironmentSP>* env_pool() { return &m_env_stubs; }
   StubPool<cogmentAPI::ServiceActorSP>* agent_pool() { return &m_agent_stubs; }
   ThreadPool& thread_pool() { return m_thread_pool; }
+  ClientEngine& client_engine() { return m_client_engine; }
+  ArenaPool& arena_pool() { return *m_arena_pool; }
+  TimerWheel& timers() { return *m_timers; }
 
   const cogmentAPI::TrialParams& default_trial_params() const { return m_default_trial_params; }
 
@@ -68,24 +142,54 @@ private:
     HandlerFunction handler;
     std::promise<void> prom;
   };
-  void m_perform_trial_gc();  // garbage collection
+  bool m_start_hooked_trial(const std::shared_ptr<Trial>& trial, cogmentAPI::TrialParams&& params);
   cogmentAPI::TrialParams m_perform_pre_hooks(cogmentAPI::TrialParams&& params, const std::string& trial_id,
                                               const std::string& user_id);
 
   cogmentAPI::TrialParams m_default_trial_params;
-  uint32_t m_gc_frequency;
+  uint32_t m_nb_buffered_samples;
+  uint32_t m_log_batch_size;
+  bool m_prehook_async;
+  bool m_tick_bundling;
+  uint32_t m_action_deadline;
+  ActorQueueOptions m_actor_queue_options;
+  DatalogQueue::Options m_datalog_queue_options;
+  DatalogServiceFile::Metrics m_datalog_file_metrics;
+  PreTrialHookCache::Metrics m_prehook_cache_metrics;
+  WarmTrialPool::Metrics m_warm_pool_metrics;
   prometheus::Summary* m_trials_metrics;
   prometheus::Summary* m_ticks_metrics;
   prometheus::Summary* m_gc_metrics;
+  prometheus::Summary* m_tick_arena_metrics;
+  prometheus::Summary* m_actor_flushes_metrics;
+  prometheus::Counter* m_late_actions_metrics;
+  prometheus::Counter* m_defaulted_actions_metrics;
+  prometheus::Family<prometheus::Summary>* m_observation_dispatch_family;
+  prometheus::Family<prometheus::Summary>* m_actor_action_family;
+  prometheus::Family<prometheus::Summary>* m_action_dispatch_family;
+  prometheus::Family<prometheus::Summary>* m_sample_cycle_family;
+  prometheus::Summary* m_warm_up_metrics;
+  prometheus::Counter* m_warm_up_failures;
+
+  // Must outlive the trials and the client engine (i.e. be destroyed after)
+  std::unique_ptr<TimerWheel> m_timers;
+
+  // Must outlive the trials (i.e. be destroyed after)
+  ClientEngine m_client_engine;
+  std::unique_ptr<ArenaPool> m_arena_pool;
+
+  std::unique_ptr<TrialRegistry> m_trials;
+  std::unique_ptr<TrialCollector> m_collector;
 
-  mutable std::mutex m_trials_mutex;
-  std::unordered_map<std::string, std::shared_ptr<Trial>> m_trials;
+  // Trial pre-hooks to invoke before actually launching trials
+  std::unique_ptr<PreTrialHooks> m_prehooks;
 
-  // List of trial pre-hooks to invoke before actually launching trials
-  using HookEntryType = std::shared_ptr<StubPool<cogmentAPI::TrialHooksSP>::Entry>;
-  std::vector<HookEntryType> m_prehooks;
+  std::unique_ptr<WarmTrialPool> m_warm_pool;
 
   ChannelPool m_channel_pool;
+  std::vector<std::string> m_prehook_urls;
+  std::vector<std::pair<std::string, std::shared_ptr<ChannelPool::Connection>>> m_warm_up_connections;
+  std::shared_future<void> m_warm_up_fut;
 
   StubPool<cogmentAPI::TrialHooksSP> m_hook_stubs;
   StubPool<cogmentAPI::DatalogSP> m_log_stubs;
@@ -95,7 +199,6 @@ private:
   mutable std::mutex m_notification_lock;
   std::vector<Watcher> m_trial_watchers;
 
-  std::atomic<int> m_gc_countdown;
   ThrQueue<std::shared_ptr<Trial>> m_trials_to_delete;
   std::future<void> m_delete_thread_fut;
 
@@ -0,0 +1,106 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/pre_trial_hook_cache.h"
+#include "cogment/utils.h"
+
+#include "spdlog/spdlog.h"
+
+#include <limits>
+
+namespace cogment {
+
+PreTrialHookCache::PreTrialHookCache(size_t max_size, uint32_t ttl, const Metrics& metrics) :
+    m_max_size(max_size),
+    m_ttl((ttl > 0) ? ttl * NANOS : std::numeric_limits<uint64_t>::max()),
+    m_metrics(metrics) {
+  if (m_max_size > 0) {
+    spdlog::info("Pre-trial hook cache of [{}] entries (time to live [{}] seconds)", m_max_size, ttl);
+  }
+}
+
+// Static
+std::string PreTrialHookCache::make_key(size_t hook_index, const std::string& user_id,
+                                        const cogmentAPI::PreTrialParams& input) {
+  std::string key;
+  append_varint(&key, hook_index);
+  append_varint(&key, user_id.size());
+  key.append(user_id);
+
+  append_deterministic(&key, input);
+
+  return key;
+}
+
+bool PreTrialHookCache::get(const std::string& key, cogmentAPI::PreTrialParams* output) {
+  if (m_max_size == 0) {
+    return false;
+  }
+  const std::lock_guard lg(m_lock);
+
+  auto itor = m_index.find(key);
+  if (itor != m_index.end()) {
+    auto entry = itor->second;
+    if (entry->expiration > Timestamp()) {
+      m_entries.splice(m_entries.begin(), m_entries, entry);
+      *output = entry->output;
+
+      if (m_metrics.hits != nullptr) {
+        m_metrics.hits->Increment();
+      }
+      return true;
+    }
+
+    m_entries.erase(entry);
+    m_index.erase(itor);
+  }
+
+  if (m_metrics.misses != nullptr) {
+    m_metrics.misses->Increment();
+  }
+  return false;
+}
+
+void PreTrialHookCache::put(const std::string& key, const cogmentAPI::PreTrialParams& output) {
+  if (m_max_size == 0) {
+    return;
+  }
+  const uint64_t now = Timestamp();
+  const uint64_t expiration = (m_ttl > std::numeric_limits<uint64_t>::max() - now) ? m_ttl : now + m_ttl;
+
+  const std::lock_guard lg(m_lock);
+
+  auto itor = m_index.find(key);
+  if (itor != m_index.end()) {
+    auto entry = itor->second;
+    entry->output = output;
+    entry->expiration = expiration;
+    m_entries.splice(m_entries.begin(), m_entries, entry);
+    return;
+  }
+
+  if (m_entries.size() >= m_max_size) {
+    m_index.erase(m_entries.back().key);
+    m_entries.pop_back();
+  }
+
+  m_entries.push_front({key, output, expiration});
+  m_index.emplace(key, m_entries.begin());
+}
+
+}  // namespace cogment
@@ -0,0 +1,73 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_PRE_TRIAL_HOOK_CACHE_H
+#define COGMENT_ORCHESTRATOR_PRE_TRIAL_HOOK_CACHE_H
+
+#include "cogment/api/hooks.pb.h"
+
+#include "prometheus/counter.h"
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace cogment {
+
+// LRU cache of pre-trial hook results, with a time to live.
+// The keys are made from the hook, the user and the (deterministically serialized) input of the hook.
+class PreTrialHookCache {
+public:
+  struct Metrics {
+    prometheus::Counter* hits = nullptr;
+    prometheus::Counter* misses = nullptr;
+  };
+
+  // Hooks can set this metadata to "false" in their reply (initial or trailing) to prevent caching
+  static constexpr const char* CACHEABLE_METADATA_KEY = "cogment-cacheable";
+
+  // `max_size` of 0 disables the cache. A `ttl` (in seconds) of 0 means no expiration.
+  PreTrialHookCache(size_t max_size, uint32_t ttl, const Metrics& metrics);
+
+  PreTrialHookCache(const PreTrialHookCache&) = delete;
+  void operator=(const PreTrialHookCache&) = delete;
+
+  bool enabled() const { return (m_max_size > 0); }
+
+  static std::string make_key(size_t hook_index, const std::string& user_id, const cogmentAPI::PreTrialParams& input);
+
+  // Returns false (miss) if there is no valid entry for the key
+  bool get(const std::string& key, cogmentAPI::PreTrialParams* output);
+  void put(const std::string& key, const cogmentAPI::PreTrialParams& output);
+
+private:
+  struct Entry {
+    std::string key;
+    cogmentAPI::PreTrialParams output;
+    uint64_t expiration;
+  };
+
+  const size_t m_max_size;
+  const uint64_t m_ttl;
+  const Metrics m_metrics;
+
+  std::mutex m_lock;
+  std::list<Entry> m_entries;  // Most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+};
+
+}  // namespace cogment
+#endif
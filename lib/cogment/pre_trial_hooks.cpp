@@ -0,0 +1,220 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/pre_trial_hooks.h"
+
+#include "spdlog/spdlog.h"
+
+#include <chrono>
+
+namespace cogment {
+
+PreTrialHooks::Run::Run(PreTrialHooks* hooks, cogmentAPI::TrialParams&& params, const std::string& trial_id,
+                        const std::string& user_id, DoneHandler&& on_done) :
+    m_hooks(hooks),
+    m_trial_id(trial_id),
+    m_user_id(user_id),
+    m_on_done(std::move(on_done)),
+    m_index(0),
+    m_cancelled(false),
+    m_call_start(0) {
+  *m_params.mutable_params() = std::move(params);
+}
+
+void PreTrialHooks::Run::cancel() {
+  const std::lock_guard lg(m_lock);
+  m_cancelled = true;
+  if (m_call != nullptr) {
+    m_call->cancel();
+  }
+}
+
+void PreTrialHooks::Run::call_next(std::shared_ptr<Run> self) {
+  std::unique_lock ul(m_lock);
+
+  if (m_cancelled) {
+    ul.unlock();
+    finish("Cancelled");
+    return;
+  }
+
+  // Cached results are used without calling the hooks
+  auto cache = m_hooks->m_cache.get();
+  if (cache != nullptr && cache->enabled()) {
+    while (m_index < m_hooks->m_hooks.size()) {
+      m_cache_key = PreTrialHookCache::make_key(m_index, m_user_id, m_params);
+      cogmentAPI::PreTrialParams cached;
+      if (!cache->get(m_cache_key, &cached)) {
+        break;
+      }
+      SPDLOG_TRACE("Trial [{}] - Using cached result of pre-trial hook [{}]", m_trial_id,
+                   m_hooks->m_hooks[m_index].name);
+      m_params = std::move(cached);
+      m_index++;
+    }
+  }
+
+  if (m_index >= m_hooks->m_hooks.size()) {
+    ul.unlock();
+    finish({});
+    return;
+  }
+
+  auto& hook = m_hooks->m_hooks[m_index];
+  SPDLOG_TRACE("Trial [{}] - Calling pre-trial hook [{}]", m_trial_id, hook.name);
+
+  m_call = AsyncUnaryCall<cogmentAPI::PreTrialParams>::make(m_hooks->m_engine);
+  auto context = m_call->context();
+  context->AddMetadata("trial-id", m_trial_id);
+  context->AddMetadata("user-id", m_user_id);
+
+  const uint32_t timeout = (hook.timeout > 0) ? hook.timeout : m_hooks->m_default_timeout;
+  if (timeout > 0) {
+    context->set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(timeout));
+  }
+
+  auto call = hook.stub_entry->get_stub().PrepareAsyncOnPreTrial(context, m_params, m_call->queue());
+  m_call_start = Timestamp();
+  m_call->start(std::move(call), [this, self = std::move(self)](const grpc::Status& status,
+                                                                cogmentAPI::PreTrialParams&& reply) mutable {
+    hook_done(std::move(self), status, std::move(reply));
+  });
+}
+
+void PreTrialHooks::Run::hook_done(std::shared_ptr<Run> self, const grpc::Status& status,
+                                   cogmentAPI::PreTrialParams&& reply) {
+  std::unique_lock ul(m_lock);
+  const bool cacheable = status.ok() && cacheable_reply();
+  m_call.reset();
+
+  auto& hook = m_hooks->m_hooks[m_index];
+  if (hook.latency != nullptr) {
+    hook.latency->Observe(static_cast<double>(Timestamp() - m_call_start) * NANOS_INV);
+  }
+
+  if (!status.ok()) {
+    auto error = fmt::format("Pre-trial hook [{}] failed [{}]: {}", hook.name, static_cast<int>(status.error_code()),
+                             status.error_message());
+    ul.unlock();
+    finish(error);
+    return;
+  }
+
+  auto cache = m_hooks->m_cache.get();
+  if (cacheable && cache != nullptr && cache->enabled()) {
+    cache->put(m_cache_key, reply);
+  }
+
+  m_params = std::move(reply);
+  m_index++;
+  ul.unlock();
+
+  call_next(std::move(self));
+}
+
+// Must be called with m_lock held, before the call is released
+bool PreTrialHooks::Run::cacheable_reply() const {
+  auto not_cacheable = [](const std::multimap<grpc::string_ref, grpc::string_ref>& metadata) {
+    for (auto value : FromMetadata(metadata, PreTrialHookCache::CACHEABLE_METADATA_KEY)) {
+      if (value == "false") {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  auto context = m_call->context();
+  return !(not_cacheable(context->GetServerInitialMetadata()) || not_cacheable(context->GetServerTrailingMetadata()));
+}
+
+void PreTrialHooks::Run::finish(const std::string& error) {
+  m_hooks->run_done(this);
+
+  auto on_done = std::move(m_on_done);
+  m_on_done = nullptr;
+  if (!on_done) {
+    return;
+  }
+
+  try {
+    if (error.empty()) {
+      on_done(std::move(*m_params.mutable_params()), error);
+    }
+    else {
+      on_done(cogmentAPI::TrialParams(), error);
+    }
+  }
+  catch (const std::exception& exc) {
+    spdlog::error("Trial [{}] - Pre-trial hooks done handler failed [{}]", m_trial_id, exc.what());
+  }
+  catch (...) {
+    spdlog::error("Trial [{}] - Pre-trial hooks done handler failed", m_trial_id);
+  }
+}
+
+PreTrialHooks::PreTrialHooks(ClientEngine* engine, prometheus::Family<prometheus::Summary>* latency_family) :
+    m_engine(engine), m_latency_family(latency_family), m_default_timeout(0) {}
+
+PreTrialHooks::~PreTrialHooks() {
+  std::unique_lock ul(m_runs_lock);
+  for (auto run : m_runs) {
+    run->cancel();
+  }
+
+  m_runs_cond.wait(ul, [this]() {
+    return m_runs.empty();
+  });
+}
+
+void PreTrialHooks::add(StubEntryType&& stub_entry, const std::string& name, uint32_t timeout) {
+  prometheus::Summary* latency = nullptr;
+  if (m_latency_family != nullptr) {
+    latency = &(m_latency_family->Add({{"hook", name}}, prometheus::Summary::Quantiles()));
+  }
+
+  m_hooks.push_back({std::move(stub_entry), name, timeout, latency});
+}
+
+std::shared_ptr<PreTrialHooks::Run> PreTrialHooks::run(cogmentAPI::TrialParams&& params, const std::string& trial_id,
+                                                       const std::string& user_id, DoneHandler&& on_done) {
+  auto new_run = std::make_shared<Run>(this, std::move(params), trial_id, user_id, std::move(on_done));
+
+  {
+    const std::lock_guard lg(m_runs_lock);
+    m_runs.insert(new_run.get());
+  }
+  new_run->call_next(new_run);
+
+  return new_run;
+}
+
+void PreTrialHooks::cancel_all() {
+  const std::lock_guard lg(m_runs_lock);
+  for (auto run : m_runs) {
+    run->cancel();
+  }
+}
+
+void PreTrialHooks::run_done(Run* run) {
+  std::unique_lock ul(m_runs_lock);
+  m_runs.erase(run);
+  ul.unlock();
+  m_runs_cond.notify_all();
+}
+
+}  // namespace cogment
@@ -0,0 +1,126 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_PRE_TRIAL_HOOKS_H
+#define COGMENT_ORCHESTRATOR_PRE_TRIAL_HOOKS_H
+
+#include "cogment/async_client.h"
+#include "cogment/pre_trial_hook_cache.h"
+#include "cogment/stub_pool.h"
+
+#include "cogment/api/hooks.grpc.pb.h"
+
+#include "prometheus/family.h"
+#include "prometheus/summary.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace cogment {
+
+// Asynchronous chain of pre-trial hooks.
+// The hooks are called in the order they were added, the output of a hook being the input of the next.
+// Each call has its own deadline, and no thread waits for the replies.
+class PreTrialHooks {
+public:
+  using StubEntryType = std::shared_ptr<StubPool<cogmentAPI::TrialHooksSP>::Entry>;
+
+  // An empty error means that all hooks succeeded
+  using DoneHandler = std::function<void(cogmentAPI::TrialParams&& params, const std::string& error)>;
+
+  // Execution of the chain for one trial
+  class Run {
+  public:
+    Run(PreTrialHooks* hooks, cogmentAPI::TrialParams&& params, const std::string& trial_id,
+        const std::string& user_id, DoneHandler&& on_done);
+
+    // The done handler will be called promptly with an error (unless it was already called)
+    void cancel();
+
+  private:
+    friend class PreTrialHooks;
+    void call_next(std::shared_ptr<Run> self);
+    void hook_done(std::shared_ptr<Run> self, const grpc::Status& status, cogmentAPI::PreTrialParams&& reply);
+    void finish(const std::string& error);
+    bool cacheable_reply() const;
+
+    PreTrialHooks* const m_hooks;
+    const std::string m_trial_id;
+    const std::string m_user_id;
+    DoneHandler m_on_done;
+
+    std::mutex m_lock;
+    cogmentAPI::PreTrialParams m_params;
+    size_t m_index;
+    bool m_cancelled;
+    uint64_t m_call_start;
+    std::string m_cache_key;
+    std::shared_ptr<AsyncUnaryCall<cogmentAPI::PreTrialParams>> m_call;
+  };
+
+  // `latency_family` can be null (no metrics)
+  PreTrialHooks(ClientEngine* engine, prometheus::Family<prometheus::Summary>* latency_family);
+
+  // Cancels the runs in progress and waits for them to be done (the engine must still be running)
+  ~PreTrialHooks();
+
+  PreTrialHooks(const PreTrialHooks&) = delete;
+  void operator=(const PreTrialHooks&) = delete;
+
+  // Hooks must all be added before any run. A timeout of 0 uses the default timeout.
+  void add(StubEntryType&& stub_entry, const std::string& name, uint32_t timeout);
+  size_t size() const { return m_hooks.size(); }
+
+  // Timeout (in seconds) of the hooks without their own timeout, 0 for no limit
+  void set_default_timeout(uint32_t seconds) { m_default_timeout = seconds; }
+
+  // Results of hooks are reused for identical inputs (and user) while in the cache
+  void set_cache(std::unique_ptr<PreTrialHookCache> cache) { m_cache = std::move(cache); }
+  bool caching() const { return (m_cache != nullptr && m_cache->enabled()); }
+
+  // The handler is called once, from an engine thread (or from this thread if there are no hooks).
+  std::shared_ptr<Run> run(cogmentAPI::TrialParams&& params, const std::string& trial_id,
+                           const std::string& user_id, DoneHandler&& on_done);
+
+  // Cancels all the runs in progress
+  void cancel_all();
+
+private:
+  struct Hook {
+    StubEntryType stub_entry;
+    std::string name;
+    uint32_t timeout;
+    prometheus::Summary* latency;
+  };
+
+  void run_done(Run* run);
+
+  ClientEngine* const m_engine;
+  prometheus::Family<prometheus::Summary>* const m_latency_family;
+  std::vector<Hook> m_hooks;
+  uint32_t m_default_timeout;
+  std::unique_ptr<PreTrialHookCache> m_cache;
+
+  std::mutex m_runs_lock;
+  std::condition_variable m_runs_cond;
+  std::unordered_set<Run*> m_runs;
+};
+
+}  // namespace cogment
+#endif
@@ -0,0 +1,59 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/receiver_routes.h"
+#include "cogment/actor.h"
+
+namespace cogment {
+
+void ReceiverRoutes::build(const std::vector<std::unique_ptr<Actor>>& actors) {
+  m_routes.clear();
+
+  // An exact actor name has precedence over the patterns
+  for (uint32_t index = 0; index < actors.size(); index++) {
+    m_routes[actors[index]->actor_name()].emplace_back(index);
+  }
+
+  auto add_route = [this, &actors](const std::string& pattern, uint32_t index) {
+    auto [itor, inserted] = m_routes.try_emplace(pattern);
+    auto& indexes = itor->second;
+    if (inserted) {
+      indexes.emplace_back(index);
+    }
+    else if (indexes.back() != index && (indexes.size() != 1 || actors[indexes[0]]->actor_name() != pattern)) {
+      indexes.emplace_back(index);
+    }
+  };
+
+  for (uint32_t index = 0; index < actors.size(); index++) {
+    const auto& actor = actors[index];
+    add_route("*", index);
+    add_route(actor->actor_class() + ".*", index);
+    add_route(actor->actor_class() + "." + actor->actor_name(), index);
+  }
+}
+
+const ReceiverRoutes::Indexes* ReceiverRoutes::find(const std::string& pattern) const {
+  auto itor = m_routes.find(pattern);
+  if (itor == m_routes.end()) {
+    return nullptr;
+  }
+  return &(itor->second);
+}
+
+}  // namespace cogment
@@ -0,0 +1,48 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_RECEIVER_ROUTES_H
+#define COGMENT_ORCHESTRATOR_RECEIVER_ROUTES_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cogment {
+class Actor;
+
+// Actors of a trial matching each receiver name pattern of rewards and messages:
+// "actor_name", "*", "class_name.*" and "class_name.actor_name".
+// All valid patterns are resolved when the actors are added, so finding the receivers
+// of a reward or message is a single lookup, without parsing or allocation.
+// Not thread safe while being built; read only afterwards.
+class ReceiverRoutes {
+public:
+  using Indexes = std::vector<uint32_t>;
+
+  // The actor indexes are their position in the vector (the actor names must be unique)
+  void build(const std::vector<std::unique_ptr<Actor>>& actors);
+
+  // Returns nullptr if no actor matches the pattern
+  const Indexes* find(const std::string& pattern) const;
+
+private:
+  std::unordered_map<std::string, Indexes> m_routes;
+};
+
+}  // namespace cogment
+
+#endif
@@ -0,0 +1,102 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/services/trial_batch_service.h"
+
+#include "cogment/orchestrator.h"
+#include "cogment/utils.h"
+
+namespace cogment {
+
+TrialBatchService::TrialBatchService(Orchestrator* orch) : m_orchestrator(orch) {}
+
+grpc::Status TrialBatchService::StartTrials(grpc::ServerContext* ctx,
+                                            const cogmentOrchestratorAPI::TrialBatchStartRequest* in,
+                                            grpc::ServerWriter<cogmentOrchestratorAPI::TrialBatchStartReply>* out) {
+  SPDLOG_TRACE("TrialBatchService::StartTrials()");
+
+  try {
+    const auto& defaults = in->defaults();
+    const size_t nb_trials = (in->requests_size() > 0) ? in->requests_size() : in->count();
+    SPDLOG_TRACE("StartTrials for [{}] trials", nb_trials);
+    if (nb_trials == 0) {
+      return grpc::Status::OK;
+    }
+
+    const auto& default_params = m_orchestrator->default_trial_params();
+    std::vector<Orchestrator::StartRequest> requests(nb_trials);
+    for (size_t index = 0; index < nb_trials; index++) {
+      const cogmentAPI::TrialStartRequest* req = nullptr;
+      if (in->requests_size() > 0) {
+        req = &in->requests(index);
+      }
+      auto& request = requests[index];
+
+      request.params = default_params;
+      const auto& config_source = (req != nullptr && req->has_config()) ? *req : defaults;
+      if (config_source.has_config()) {
+        request.params.mutable_trial_config()->set_content(config_source.config().content());
+      }
+
+      if (req != nullptr && !req->user_id().empty()) {
+        request.user_id = req->user_id();
+      }
+      else {
+        request.user_id = defaults.user_id();
+      }
+
+      if (req != nullptr) {
+        request.trial_id_req = req->trial_id_requested();
+      }
+    }
+
+    // The handler can be called after this function returns if it is interrupted
+    auto replies = std::make_shared<ThrQueue<cogmentOrchestratorAPI::TrialBatchStartReply>>();
+    m_orchestrator->start_trials(std::move(requests), [replies](size_t index, const std::string& trial_id,
+                                                                const std::string& error) {
+      cogmentOrchestratorAPI::TrialBatchStartReply reply;
+      reply.set_index(index);
+      reply.set_trial_id(trial_id);
+      reply.set_error(error);
+      replies->push(std::move(reply));
+    });
+
+    bool writing = true;
+    for (size_t count = 0; count < nb_trials; count++) {
+      auto reply = replies->pop();
+      if (!reply.error().empty()) {
+        spdlog::warn("Start of trial [{}] in batch was refused [{}]", reply.index(), reply.error());
+      }
+
+      if (writing && (ctx->IsCancelled() || !out->Write(reply))) {
+        spdlog::debug("Trial batch start request cancelled; the trials will still be started");
+        writing = false;
+      }
+    }
+  }
+  catch (const std::exception& exc) {
+    return MakeErrorStatus("TrialBatchLifecycleSP/StartTrials failure: {}", exc.what());
+  }
+  catch (...) {
+    return MakeErrorStatus("TrialBatchLifecycleSP/StartTrials failure");
+  }
+
+  return grpc::Status::OK;
+}
+
+}  // namespace cogment
@@ -19,7 +19,12 @@
 
 #include "spdlog/spdlog.h"
 #include "grpc++/grpc++.h"
+#include "grpcpp/generic/generic_stub.h"
+#include "prometheus/family.h"
+#include "prometheus/gauge.h"
 
+#include <algorithm>
+#include <atomic>
 #include <mutex>
 #include <set>
 #include <typeinfo>
@@ -38,10 +43,45 @@ namespace cogment {
 // - A stub must stay open as long as at least one trial is making use of it
 // - A stub must close as soon as no trial is making use of it.
 
-// A thread-safe pool of easy-grpc Communication channel
+// A thread-safe pool of easy-grpc Communication channel.
+// Each endpoint can have multiple connections (HTTP/2 connections, i.e. subchannels), to spread the streams
+// of the trials over more than one connection (each is limited in concurrent streams, and served by one thread).
 class ChannelPool {
 public:
-  ChannelPool(std::shared_ptr<grpc::ChannelCredentials> creds) {
+  enum class Selection { LEAST_LOADED, ROUND_ROBIN };
+
+  // One connection to an endpoint. It is closed when the last user releases it.
+  class Connection {
+  public:
+    Connection(std::shared_ptr<grpc::Channel>&& channel, size_t index, prometheus::Gauge* streams_gauge) :
+        m_channel(std::move(channel)), m_index(index), m_nb_streams(0), m_streams_gauge(streams_gauge) {}
+
+    const std::shared_ptr<grpc::Channel>& channel() const { return m_channel; }
+    size_t index() const { return m_index; }
+
+    size_t nb_streams() const { return m_nb_streams; }
+    void add_stream() {
+      m_nb_streams++;
+      if (m_streams_gauge != nullptr) {
+        m_streams_gauge->Increment();
+      }
+    }
+    void remove_stream() {
+      m_nb_streams--;
+      if (m_streams_gauge != nullptr) {
+        m_streams_gauge->Decrement();
+      }
+    }
+
+  private:
+    const std::shared_ptr<grpc::Channel> m_channel;
+    const size_t m_index;
+    std::atomic<size_t> m_nb_streams;
+    prometheus::Gauge* const m_streams_gauge;
+  };
+
+  ChannelPool(std::shared_ptr<grpc::ChannelCredentials> creds) :
+      m_nb_connections(1), m_selection(Selection::LEAST_LOADED), m_streams_family(nullptr) {
     if (creds.get() == nullptr) {
       spdlog::warn("Implicitly using unsecured channels");
       m_creds = grpc::InsecureChannelCredentials();
@@ -51,25 +91,100 @@ public:
     }
   }
 
-  std::shared_ptr<grpc::Channel> get_channel(const std::string& url) {
+  static Selection selection_from_string(std::string selection) {
+    std::transform(selection.begin(), selection.end(), selection.begin(), ::tolower);
+
+    if (selection == "least_loaded") {
+      return Selection::LEAST_LOADED;
+    }
+    else if (selection == "round_robin") {
+      return Selection::ROUND_ROBIN;
+    }
+    else {
+      throw MakeException("Unknown connection selection [{}] (must be 'least_loaded' or 'round_robin')", selection);
+    }
+  }
+
+  // Only affects the connections opened after the call
+  void set_connections(size_t nb_per_endpoint, Selection selection) {
     const std::lock_guard lg(m_map_lock);
+    m_nb_connections = std::max<size_t>(nb_per_endpoint, 1);
+    m_selection = selection;
+  }
 
-    auto& found = m_channels[url];
-    auto result = found.lock();
+  size_t nb_connections() {
+    const std::lock_guard lg(m_map_lock);
+    return m_nb_connections;
+  }
 
-    if (!result) {
-      result = grpc::CreateChannel(url, m_creds);
-      found = result;
+  // Gauges of the number of streams on each connection, labelled with the endpoint and connection index
+  void set_metrics(prometheus::Family<prometheus::Gauge>* streams_family) {
+    const std::lock_guard lg(m_map_lock);
+    m_streams_family = streams_family;
+  }
+
+  std::shared_ptr<Connection> get_connection(const std::string& url) {
+    const std::lock_guard lg(m_map_lock);
+
+    auto& endpoint = m_endpoints[url];
+    if (endpoint.connections.size() != m_nb_connections) {
+      endpoint.connections.resize(m_nb_connections);
+    }
+
+    size_t index = 0;
+    std::shared_ptr<Connection> result;
+    if (m_selection == Selection::ROUND_ROBIN) {
+      index = endpoint.next_index % m_nb_connections;
+      endpoint.next_index = index + 1;
+      result = endpoint.connections[index].lock();
+    }
+    else {
+      for (size_t conn_index = 0; conn_index < m_nb_connections; conn_index++) {
+        auto conn = endpoint.connections[conn_index].lock();
+        if (conn == nullptr) {
+          // Not opened yet (or closed): no load
+          index = conn_index;
+          result = nullptr;
+          break;
+        }
+        if (result == nullptr || conn->nb_streams() < result->nb_streams()) {
+          index = conn_index;
+          result = std::move(conn);
+        }
+      }
+    }
+
+    if (result == nullptr) {
+      // A distinct channel argument forces a separate connection (otherwise gRPC shares subchannels
+      // between channels with the same target and arguments).
+      grpc::ChannelArguments args;
+      args.SetInt("cogment.connection_index", static_cast<int>(index));
+      auto channel = grpc::CreateCustomChannel(url, m_creds, args);
+
+      prometheus::Gauge* streams_gauge = nullptr;
+      if (m_streams_family != nullptr) {
+        streams_gauge = &(m_streams_family->Add({{"endpoint", url}, {"connection", std::to_string(index)}}));
+      }
+
+      result = std::make_shared<Connection>(std::move(channel), index, streams_gauge);
+      endpoint.connections[index] = result;
     }
-    // TODO: manage the "else" for nullptr
 
     return result;
   }
 
+private:
+  struct Endpoint {
+    std::vector<std::weak_ptr<Connection>> connections;
+    size_t next_index = 0;
+  };
+
   std::mutex m_map_lock;
-  std::unordered_map<std::string, std::weak_ptr<grpc::Channel>> m_channels;
+  std::unordered_map<std::string, Endpoint> m_endpoints;
+  size_t m_nb_connections;
+  Selection m_selection;
+  prometheus::Family<prometheus::Gauge>* m_streams_family;
 
-private:
   std::shared_ptr<grpc::ChannelCredentials> m_creds;
 };
 
@@ -83,18 +198,27 @@ public:
 
   class Entry {
   public:
-    using ChannelType = std::shared_ptr<grpc::Channel>;
-    Entry(ChannelType&& chan, StubType&& stb) : m_channel(chan), m_stub(stb) {}
+    using ConnectionType = std::shared_ptr<ChannelPool::Connection>;
+    Entry(const ConnectionType& conn) :
+        m_connection(conn), m_stub(conn->channel()), m_generic_stub(conn->channel()) {}
 
     StubType& get_stub() { return m_stub; }
 
+    // For calls made with pre-serialized messages
+    grpc::GenericStub& get_generic_stub() { return m_generic_stub; }
+
+    ChannelPool::Connection& connection() { return *m_connection; }
+
   private:
     // Prevents the channel from being destroyed.
-    ChannelType m_channel;
+    ConnectionType m_connection;
 
     StubType m_stub;
+    grpc::GenericStub m_generic_stub;
   };
 
+  // Each call is counted as a stream on the connection of the entry, until the returned pointer
+  // (and all its copies) are released.
   std::shared_ptr<Entry> get_stub_entry(const std::string& url) {
     const std::lock_guard lg(m_map_lock);
 
@@ -103,25 +227,37 @@ public:
     }
 
     auto real_url = url.substr(7);
-    auto& found = m_entries[real_url];
-    auto result = found.lock();
+    auto conn = m_channel_pool->get_connection(real_url);
 
-    if (!result) {
-      spdlog::info("Opening channel for [{}] at [{}]", Service_T::service_full_name(), real_url);
-      auto channel = m_channel_pool->get_channel(real_url);
+    auto& entries = m_entries[real_url];
+    if (entries.size() <= conn->index()) {
+      entries.resize(conn->index() + 1);
+    }
+    auto& found = entries[conn->index()];
+    auto entry = found.lock();
 
-      result = std::make_shared<Entry>(std::move(channel), StubType(channel));
-      found = result;
+    if (!entry || &entry->connection() != conn.get()) {
+      spdlog::info("Opening channel for [{}] at [{}] (connection [{}])", Service_T::service_full_name(), real_url,
+                   conn->index());
+      entry = std::make_shared<Entry>(conn);
+      found = entry;
       spdlog::debug("Stub [{}] at [{}] ready for use", Service_T::service_full_name(), real_url);
     }
 
-    return result;
+    auto lease = std::make_shared<Lease>(std::move(entry));
+    return std::shared_ptr<Entry>(lease, lease->entry.get());
   }
 
 private:
+  struct Lease {
+    Lease(std::shared_ptr<Entry>&& ent) : entry(std::move(ent)) { entry->connection().add_stream(); }
+    ~Lease() { entry->connection().remove_stream(); }
+    std::shared_ptr<Entry> entry;
+  };
+
   std::mutex m_map_lock;
   ChannelPool* m_channel_pool;
-  std::unordered_map<std::string, std::weak_ptr<Entry>> m_entries;
+  std::unordered_map<std::string, std::vector<std::weak_ptr<Entry>>> m_entries;
 };
 
 }  // namespace cogment
@@ -0,0 +1,200 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/timer_wheel.h"
+
+#include "spdlog/spdlog.h"
+
+namespace cogment {
+
+TimerWheel::TimerWheel(ThreadPool* pool) :
+    m_start_time(std::chrono::steady_clock::now()), m_stop(false), m_next_id(1), m_current_tick(0) {
+  m_thread_fut = pool->push("Timer wheel", [this]() {
+    run();
+  });
+}
+
+TimerWheel::~TimerWheel() { stop(); }
+
+void TimerWheel::stop() {
+  {
+    const std::lock_guard lg(m_lock);
+    m_stop = true;
+  }
+  m_cond.notify_one();
+
+  if (m_thread_fut.valid()) {
+    m_thread_fut.wait();
+  }
+
+  // Destroyed outside the lock (they may hold the last reference to objects that use the timers)
+  std::vector<Slot> pending;
+  {
+    const std::lock_guard lg(m_lock);
+    for (auto& wheel : m_wheels) {
+      for (auto& slot : wheel) {
+        if (!slot.empty()) {
+          pending.emplace_back(std::move(slot));
+          slot.clear();
+        }
+      }
+    }
+    m_timers.clear();
+  }
+}
+
+uint64_t TimerWheel::now_tick() const {
+  return static_cast<uint64_t>((std::chrono::steady_clock::now() - m_start_time) / TICK_DURATION);
+}
+
+TimerWheel::TimerId TimerWheel::schedule(std::chrono::nanoseconds delay, Callback&& callback) {
+  // Rounded up so timers never fire early
+  const auto expiry_time = std::chrono::steady_clock::now() + delay - m_start_time + TICK_DURATION;
+  const auto expiry_tick = static_cast<uint64_t>((expiry_time - std::chrono::nanoseconds(1)) / TICK_DURATION);
+
+  std::unique_lock ul(m_lock);
+
+  const TimerId timer_id = m_next_id++;
+  if (m_stop) {
+    ul.unlock();
+    callback = nullptr;
+    return timer_id;
+  }
+  const bool was_empty = m_timers.empty();
+  insert({timer_id, std::max(expiry_tick, m_current_tick + 1), std::move(callback)});
+  ul.unlock();
+
+  // The timer thread does not wake up when there are no timers
+  if (was_empty) {
+    m_cond.notify_one();
+  }
+
+  return timer_id;
+}
+
+bool TimerWheel::cancel(TimerId timer_id) {
+  Callback callback;  // Destroyed outside the lock
+
+  const std::lock_guard lg(m_lock);
+  auto itor = m_timers.find(timer_id);
+  if (itor == m_timers.end()) {
+    return false;
+  }
+
+  auto [slot, timer_itor] = itor->second;
+  callback = std::move(timer_itor->callback);
+  slot->erase(timer_itor);
+  m_timers.erase(itor);
+
+  return true;
+}
+
+// Must be called with m_lock held
+void TimerWheel::insert(Timer&& timer) {
+  // Timers due in the current tick go in the current slot (this happens only while advancing)
+  const uint64_t expiry_tick = std::max(timer.expiry_tick, m_current_tick);
+  const uint64_t delta = expiry_tick - m_current_tick;
+
+  size_t level = 0;
+  while (level < NB_LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+    level++;
+  }
+
+  // Timers beyond the range of the wheel are re-inserted when their slot comes up
+  const uint64_t max_delta = (uint64_t(1) << (SLOT_BITS * NB_LEVELS)) - 1;
+  const uint64_t slot_tick = m_current_tick + std::min(delta, max_delta);
+
+  auto& slot = m_wheels[level][(slot_tick >> (SLOT_BITS * level)) & SLOT_MASK];
+  const TimerId timer_id = timer.id;
+  slot.emplace_back(std::move(timer));
+  m_timers[timer_id] = {&slot, std::prev(slot.end())};
+}
+
+// Must be called with m_lock held
+void TimerWheel::advance(uint64_t to_tick, std::vector<Callback>* expired) {
+  if (m_timers.empty()) {
+    m_current_tick = std::max(m_current_tick, to_tick);
+    return;
+  }
+
+  while (m_current_tick < to_tick) {
+    m_current_tick++;
+
+    // Higher level slots are cascaded down when the lower levels wrap around
+    for (size_t level = NB_LEVELS - 1; level > 0; level--) {
+      const uint64_t level_mask = (uint64_t(1) << (SLOT_BITS * level)) - 1;
+      if ((m_current_tick & level_mask) != 0) {
+        continue;
+      }
+
+      Slot cascaded;
+      cascaded.swap(m_wheels[level][(m_current_tick >> (SLOT_BITS * level)) & SLOT_MASK]);
+      for (auto& timer : cascaded) {
+        insert(std::move(timer));
+      }
+    }
+
+    Slot current;
+    current.swap(m_wheels[0][m_current_tick & SLOT_MASK]);
+    for (auto& timer : current) {
+      if (timer.expiry_tick <= m_current_tick) {
+        m_timers.erase(timer.id);
+        expired->emplace_back(std::move(timer.callback));
+      }
+      else {
+        insert(std::move(timer));
+      }
+    }
+  }
+}
+
+void TimerWheel::run() {
+  std::unique_lock ul(m_lock);
+
+  while (!m_stop) {
+    std::vector<Callback> expired;
+    advance(now_tick(), &expired);
+
+    if (!expired.empty()) {
+      ul.unlock();
+      for (auto& callback : expired) {
+        try {
+          callback();
+        }
+        catch (const std::exception& exc) {
+          spdlog::error("Timer callback failed [{}]", exc.what());
+        }
+        catch (...) {
+          spdlog::error("Timer callback failed");
+        }
+      }
+      expired.clear();
+      ul.lock();
+      continue;
+    }
+
+    if (m_timers.empty()) {
+      m_cond.wait(ul);
+    }
+    else {
+      m_cond.wait_until(ul, m_start_time + (m_current_tick + 1) * TICK_DURATION);
+    }
+  }
+}
+
+}  // namespace cogment
@@ -0,0 +1,89 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_TIMER_WHEEL_H
+#define COGMENT_ORCHESTRATOR_TIMER_WHEEL_H
+
+#include "cogment/utils.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace cogment {
+
+// Hierarchical timer wheel: timers are scheduled and cancelled in constant time, and a single
+// thread fires all of them (with a resolution of TICK_DURATION).
+// The callbacks are called in the timer thread, so they must be short (long work should be
+// pushed to the thread pool), and they must not be called with locks that are needed to schedule timers.
+class TimerWheel {
+public:
+  using TimerId = uint64_t;
+  using Callback = std::function<void()>;
+  static constexpr auto TICK_DURATION = std::chrono::milliseconds(10);
+
+  TimerWheel(ThreadPool* pool);
+  ~TimerWheel();
+
+  TimerWheel(const TimerWheel&) = delete;
+  void operator=(const TimerWheel&) = delete;
+
+  // After `stop`, the callback is released without being scheduled
+  TimerId schedule(std::chrono::nanoseconds delay, Callback&& callback);
+
+  // Returns false if the timer already fired (or was already cancelled)
+  bool cancel(TimerId timer_id);
+
+  // No timer fires after this returns, and the pending callbacks are released.
+  // The wheel can still be used (nothing is scheduled), so it can outlive its users safely.
+  void stop();
+
+private:
+  static constexpr size_t SLOT_BITS = 6;
+  static constexpr size_t NB_SLOTS = 1 << SLOT_BITS;
+  static constexpr uint64_t SLOT_MASK = NB_SLOTS - 1;
+  static constexpr size_t NB_LEVELS = 4;  // Over 46 hours at 10ms per tick (longer timers are re-inserted)
+
+  struct Timer {
+    TimerId id;
+    uint64_t expiry_tick;
+    Callback callback;
+  };
+  using Slot = std::list<Timer>;
+
+  void run();
+  uint64_t now_tick() const;
+  void insert(Timer&& timer);
+  void advance(uint64_t to_tick, std::vector<Callback>* expired);
+
+  const std::chrono::steady_clock::time_point m_start_time;
+
+  std::mutex m_lock;
+  std::condition_variable m_cond;
+  bool m_stop;
+  TimerId m_next_id;
+  uint64_t m_current_tick;
+  std::array<std::array<Slot, NB_SLOTS>, NB_LEVELS> m_wheels;
+  std::unordered_map<TimerId, std::pair<Slot*, Slot::iterator>> m_timers;
+
+  std::future<void> m_thread_fut;
+};
+
+}  // namespace cogment
+#endif
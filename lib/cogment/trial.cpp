@@ -24,9 +24,11 @@
 #include "cogment/client_actor.h"
 #include "cogment/datalog.h"
 #include "cogment/stub_pool.h"
+#include "cogment/warm_trial_pool.h"
 
 #include "spdlog/spdlog.h"
 
+#include <algorithm>
 #include <limits>
 #include <chrono>
 
@@ -37,6 +39,9 @@ constexpr int64_t AUTO_TICK_ID = -1;     // The actual tick ID will be determine
 constexpr int64_t NO_DATA_TICK_ID = -2;  // When we have received no data (different from default/empty data)
 constexpr uint64_t MAX_TICK_ID = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
 
+constexpr auto ENV_LAST_ACK_TIMEOUT = std::chrono::seconds(60);
+constexpr auto ACTORS_LAST_ACK_TIMEOUT = std::chrono::seconds(30);
+
 const char* get_trial_state_string(Trial::InternalState state) {
   switch (state) {
   case Trial::InternalState::unknown:
@@ -87,9 +92,18 @@ Trial::Trial(Orchestrator* orch, const std::string& user_id, const std::string&
     m_end_requested(false),
     m_tick_id(0),
     m_tick_start_timestamp(0),
+    m_tick_arena_heap_blocks(0),
     m_nb_actors_acted(0),
     m_max_steps(std::numeric_limits<uint64_t>::max()),
-    m_max_inactivity(std::numeric_limits<uint64_t>::max()) {
+    m_max_inactivity(std::numeric_limits<uint64_t>::max()),
+    m_action_timer(0),
+    m_default_action_deadline(orch->action_deadline() * (NANOS / 1000)),
+    m_obs_dispatch_timestamp(0),
+    m_tick_bundling(orch->tick_bundling()),
+    m_nb_actor_flushes(0),
+    m_nb_buffered_samples(orch->nb_buffered_samples()),
+    m_log_batch_size(orch->log_batch_size()),
+    m_step_data(m_nb_buffered_samples + m_log_batch_size) {
   SPDLOG_TRACE("Trial [{}] - Constructor", m_id);
 
   set_state(InternalState::initializing);
@@ -104,12 +118,16 @@ Trial::~Trial() {
   }
 
   // Destroy components while this trial instance still exists
+  m_warm_trial.reset();
   m_env.reset();
   m_actors.clear();
   m_datalog.reset();
 }
 
 ThreadPool& Trial::thread_pool() { return m_orchestrator->thread_pool(); }
+ClientEngine& Trial::client_engine() { return m_orchestrator->client_engine(); }
+ArenaPool::Lease Trial::acquire_arena() { return m_orchestrator->arena_pool().acquire(&m_tick_arena_heap_blocks); }
+const ActorQueueOptions& Trial::actor_queue_options() const { return m_orchestrator->actor_queue_options(); }
 
 const std::string& Trial::env_name() const {
   if (m_env != nullptr) {
@@ -193,8 +211,16 @@ cogmentAPI::DatalogSample& Trial::make_new_sample() {
     m_step_data.back().mutable_info()->set_state(get_trial_api_state(m_state));
   }
 
-  m_step_data.emplace_back();
-  auto& sample = m_step_data.back();
+  // Should not happen since the buffer is cycled every tick
+  if (m_step_data.full()) {
+    spdlog::warn("Trial [{}] - Sample buffer full, sending oldest sample to datalog early", m_id);
+    m_datalog->add_sample(m_step_data.front());
+    m_step_data.pop_front();
+  }
+
+  // The sample is recycled (cleared, not reallocated) to keep its memory
+  auto& sample = m_step_data.push_back();
+  sample.Clear();
 
   auto sample_actions = sample.mutable_actions();
   sample_actions->Reserve(m_actors.size());
@@ -220,8 +246,9 @@ void Trial::flush_samples() {
   }
 
   if (m_datalog != nullptr) {
-    for (auto& sample : m_step_data) {
-      m_datalog->add_sample(std::move(sample));
+    while (!m_step_data.empty()) {
+      m_datalog->add_sample(m_step_data.front());
+      m_step_data.pop_front();
     }
   }
 
@@ -236,8 +263,12 @@ void Trial::prepare_actors() {
     throw MakeException("Environment not ready for actors");
   }
 
+  m_action_states = std::vector<ActorActionState>(m_params.actors_size());
+
   for (const auto& actor_info : m_params.actors()) {
-    auto url = actor_info.endpoint();
+    std::unordered_map<std::string, std::string> url_query;
+    const auto url = split_url_query(actor_info.endpoint(), &url_query);
+    const auto index = static_cast<uint32_t>(m_actors.size());
 
     if (url.empty() || actor_info.name().empty() || actor_info.actor_class().empty()) {
       throw MakeException("Actor [{}] not fully defined in parameters", actor_info.name());
@@ -247,25 +278,53 @@ void Trial::prepare_actors() {
       throw MakeException("Actor name cannot be the same as environment name [{}]", m_env->name());
     }
 
+    auto& action_state = m_action_states[index];
+    action_state.deadline = m_default_action_deadline;
+    auto deadline_itor = url_query.find("action_deadline");
+    if (deadline_itor != url_query.end()) {
+      try {
+        action_state.deadline = std::stoull(deadline_itor->second) * (NANOS / 1000);
+      }
+      catch (...) {
+        throw MakeException("Invalid action deadline [{}] for actor [{}]", deadline_itor->second, actor_info.name());
+      }
+    }
+    if (action_state.deadline > 0) {
+      m_deadline_steps.emplace_back(action_state.deadline);
+    }
+
     if (url == "client" || url == "cogment://client") {
       if (url == "client") {
         spdlog::warn("Client actor endpoint must be 'cogment://client' in the parameters [{}]", url);
       }
 
-      auto client_actor = std::make_unique<ClientActor>(this, actor_info);
+      auto client_actor = std::make_unique<ClientActor>(this, index, actor_info);
       m_actors.emplace_back(std::move(client_actor));
     }
     else {
-      auto stub_entry = m_orchestrator->agent_pool()->get_stub_entry(url);
-      auto agent_actor = std::make_unique<ServiceActor>(this, actor_info, stub_entry);
+      ClientStream::StubEntryType stub_entry;
+      std::shared_ptr<ClientStream::StreamType> opened_stream;
+      if (m_warm_trial != nullptr) {
+        opened_stream = m_warm_trial->take_actor(url, &stub_entry);
+      }
+      if (opened_stream == nullptr) {
+        stub_entry = m_orchestrator->agent_pool()->get_stub_entry(url);
+      }
+      auto agent_actor =
+          std::make_unique<ServiceActor>(this, index, actor_info, stub_entry, std::move(opened_stream));
       m_actors.emplace_back(std::move(agent_actor));
     }
 
-    auto [itor, inserted] = m_actor_indexes.emplace(actor_info.name(), m_actors.size() - 1);
+    auto [itor, inserted] = m_actor_indexes.emplace(actor_info.name(), index);
     if (!inserted) {
       throw MakeException("Actor name is not unique [{}]", actor_info.name());
     }
   }
+
+  m_receiver_routes.build(m_actors);
+
+  std::sort(m_deadline_steps.begin(), m_deadline_steps.end());
+  m_deadline_steps.erase(std::unique(m_deadline_steps.begin(), m_deadline_steps.end()), m_deadline_steps.end());
 }
 
 void Trial::prepare_environment() {
@@ -274,13 +333,20 @@ void Trial::prepare_environment() {
     throw MakeException("No environment endpoint provided in parameters");
   }
 
-  auto stub_entry = m_orchestrator->env_pool()->get_stub_entry(env_params.endpoint());
-  m_env = std::make_unique<Environment>(this, env_params, stub_entry);
+  Environment::StubEntryType stub_entry;
+  std::shared_ptr<Environment::StreamType> opened_stream;
+  if (m_warm_trial != nullptr) {
+    opened_stream = m_warm_trial->take_environment(env_params.endpoint(), &stub_entry);
+  }
+  if (opened_stream == nullptr) {
+    stub_entry = m_orchestrator->env_pool()->get_stub_entry(env_params.endpoint());
+  }
+  m_env = std::make_unique<Environment>(this, env_params, stub_entry, std::move(opened_stream));
 }
 
 void Trial::prepare_datalog() {
   if (!m_params.has_datalog()) {
-    m_datalog = std::make_unique<DatalogServiceNull>();
+    m_datalog = std::make_shared<DatalogServiceNull>();
   }
   else {
     auto& url = m_params.datalog().endpoint();
@@ -288,13 +354,30 @@ void Trial::prepare_datalog() {
       throw MakeException("Parameter Datalog endpoint missing");
     }
 
-    auto stub_entry = m_orchestrator->log_pool()->get_stub_entry(url);
-    m_datalog = std::make_unique<DatalogServiceImpl>(stub_entry);
+    if (url.find("file://") == 0) {
+      m_datalog = std::make_shared<DatalogServiceFile>(url, &thread_pool(), m_orchestrator->datalog_queue_options(),
+                                                       m_orchestrator->datalog_file_metrics());
+    }
+    else {
+      std::unordered_map<std::string, std::string> url_query;
+      auto base_url = split_url_query(url, &url_query);
+
+      auto stub_entry = m_orchestrator->log_pool()->get_stub_entry(base_url);
+      m_datalog = std::make_shared<DatalogServiceImpl>(
+          stub_entry, &client_engine(), m_orchestrator->datalog_queue_options(), m_log_batch_size, url_query);
+    }
   }
 
   m_datalog->start(m_id, m_user_id, m_params);
 }
 
+void Trial::set_warm_connections(std::unique_ptr<WarmTrial> warm_trial) {
+  if (warm_trial != nullptr && warm_trial->trial_id() != m_id) {
+    throw MakeException("Warm connections are for a different trial [{}]", warm_trial->trial_id());
+  }
+  m_warm_trial = std::move(warm_trial);
+}
+
 void Trial::start(cogmentAPI::TrialParams&& params) {
   SPDLOG_TRACE("Trial [{}] - Starting", m_id);
 
@@ -320,6 +403,8 @@ void Trial::start(cogmentAPI::TrialParams&& params) {
   prepare_datalog();
   prepare_environment();
   prepare_actors();
+  prepare_phase_metrics();
+  m_warm_trial.reset();  // Closes the unused connections
 
   make_new_sample();  // First sample
 
@@ -356,6 +441,19 @@ void Trial::start(cogmentAPI::TrialParams&& params) {
   spdlog::debug("Trial [{}] - Configured", m_id);
 }
 
+template <class FUNC>
+bool Trial::for_actors(const std::string& pattern, FUNC&& func) {
+  const auto indexes = m_receiver_routes.find(pattern);
+  if (indexes == nullptr) {
+    return false;
+  }
+
+  for (const auto index : *indexes) {
+    func(m_actors[index].get());
+  }
+  return true;
+}
+
 void Trial::reward_received(const std::string& sender, cogmentAPI::Reward&& reward) {
   if (m_state < InternalState::pending) {
     spdlog::warn("Too early for trial [{}] to receive rewards.", m_id);
@@ -380,19 +478,21 @@ void Trial::reward_received(const std::string& sender, cogmentAPI::Reward&& rewa
     return;
   }
 
-  // Rewards are not dispatched as we receive them. They are accumulated, and sent once
-  // per update.
-  bool valid_name = for_actors(new_rew->receiver_name(), [this, new_rew, &sender](auto actor) {
-    // Normally we should have only one source when receiving
-    for (auto& src : *new_rew->mutable_sources()) {
-      src.set_sender_name(sender);
-      actor->add_reward_src(src, m_tick_id);
-    }
-  });
-
-  if (!valid_name) {
+  const auto receivers = m_receiver_routes.find(new_rew->receiver_name());
+  if (receivers == nullptr) {
     spdlog::error("Trial [{}] - Unknown receiver as reward destination [{}] from [{}]", m_id, new_rew->receiver_name(),
                   sender);
+    return;
+  }
+
+  // Rewards are not dispatched as we receive them. They are accumulated, and sent once
+  // per update (the receivers accumulate them when they are dispatched).
+  const uint64_t tick_id = m_tick_id;
+  const std::lock_guard lg(m_reward_lock);
+  // Normally we should have only one source when receiving
+  for (auto& src : *new_rew->mutable_sources()) {
+    src.set_sender_name(sender);
+    m_pending_rewards.push_back({tick_id, receivers, src});
   }
 }
 
@@ -426,8 +526,10 @@ void Trial::message_received(const std::string& sender, cogmentAPI::Message&& me
     m_env->send_message(*new_msg, m_tick_id);
   }
   else {
-    bool valid_name = for_actors(new_msg->receiver_name(), [this, new_msg](auto actor) {
-      actor->send_message(*new_msg, m_tick_id);
+    // The message content is serialized only once for all receivers
+    SharedActorMessage shared_msg(*new_msg, m_tick_id);
+    bool valid_name = for_actors(new_msg->receiver_name(), [&shared_msg](auto actor) {
+      actor->send_message(&shared_msg);
     });
 
     if (!valid_name) {
@@ -437,55 +539,6 @@ void Trial::message_received(const std::string& sender, cogmentAPI::Message&& me
   }
 }
 
-bool Trial::for_actors(const std::string& pattern, const std::function<void(Actor*)>& func) {
-  // If exact name
-  const auto actor_index_itor = m_actor_indexes.find(pattern);
-  if (actor_index_itor != m_actor_indexes.end()) {
-    const uint32_t index = actor_index_itor->second;
-    func(m_actors[index].get());
-    return true;
-  }
-
-  // If all actors
-  if (pattern == "*") {
-    for (const auto& actor : m_actors) {
-      func(actor.get());
-    }
-    return true;
-  }
-
-  // If "class_name.actor_name" where actor_name can be "*"
-  auto pos = pattern.find('.');
-  if (pos != pattern.npos) {
-    const auto class_name = pattern.substr(0, pos);
-    const auto actor_name = pattern.substr(pos + 1);
-
-    // If "class_name.*"
-    if (actor_name == "*") {
-      bool at_least_one = false;
-      for (const auto& actor : m_actors) {
-        if (actor->actor_class() == class_name) {
-          at_least_one = true;
-          func(actor.get());
-        }
-      }
-
-      return at_least_one;
-    }
-
-    const auto actor_index_itor = m_actor_indexes.find(actor_name);
-    if (actor_index_itor != m_actor_indexes.end()) {
-      const uint32_t index = actor_index_itor->second;
-      if (m_actors[index]->actor_class() == class_name) {
-        func(m_actors[index].get());
-        return true;
-      }
-    }
-  }
-
-  return false;
-}
-
 void Trial::dispatch_observations(bool last) {
   if (m_state == InternalState::ended) {
     return;
@@ -499,152 +552,168 @@ void Trial::dispatch_observations(bool last) {
 
   const auto& observations = sample->observations();
 
-  std::uint32_t actor_index = 0;
-  for (const auto& actor : m_actors) {
+  // Each distinct observation is built (and serialized) only once for all the actors receiving it
+  std::vector<std::shared_ptr<SharedActorInput>> shared_obs(observations.observations_size());
+  for (std::uint32_t actor_index = 0; actor_index < m_actors.size(); actor_index++) {
     auto obs_index = observations.actors_map(actor_index);
-    cogmentAPI::Observation obs;
-    obs.set_tick_id(m_tick_id);
-    obs.set_timestamp(observations.timestamp());
-    *obs.mutable_content() = observations.observations(obs_index);
-    actor->dispatch_tick(std::move(obs), last);
+    auto& obs = shared_obs.at(obs_index);
+    if (obs == nullptr) {
+      ActorStream::InputType msg;
+      msg.set_state(cogmentAPI::CommunicationState::NORMAL);
+      auto obs_msg = msg.mutable_observation();
+      obs_msg->set_tick_id(m_tick_id);
+      obs_msg->set_timestamp(observations.timestamp());
+      *obs_msg->mutable_content() = observations.observations(obs_index);
+      obs = std::make_shared<SharedActorInput>(std::move(msg));
+    }
+  }
+
+  // The actors refer to the dispatched rewards until the end of their `dispatch_tick`
+  {
+    const std::lock_guard lg(m_reward_lock);
+    m_dispatched_rewards.swap(m_pending_rewards);
+  }
+  for (const auto& pending : m_dispatched_rewards) {
+    for (const auto index : *pending.receivers) {
+      m_actors[index]->add_reward_src(&pending.source, pending.tick_id);
+    }
+  }
 
+  std::uint32_t actor_index = 0;
+  for (const auto& actor : m_actors) {
+    m_action_states[actor_index].observed_tick = m_tick_id + 1;
+    actor->dispatch_tick(shared_obs[observations.actors_map(actor_index)], last);
     ++actor_index;
   }
+
+  if (m_metrics.actor_flushes != nullptr && !m_actors.empty()) {
+    uint64_t nb_flushes = 0;
+    for (const auto& actor : m_actors) {
+      nb_flushes += actor->nb_flushes();
+    }
+    const auto nb_tick_flushes = nb_flushes - m_nb_actor_flushes;
+    m_metrics.actor_flushes->Observe(static_cast<double>(nb_tick_flushes) / m_actors.size());
+    m_nb_actor_flushes = nb_flushes;
+  }
+
+  m_dispatched_rewards.clear();
 }
 
 void Trial::cycle_buffer() {
   const std::lock_guard lg(m_sample_lock);
 
-  static constexpr uint64_t MIN_NB_BUFFERED_SAMPLES = 2;  // Because of the way we use the buffer
-  static constexpr uint64_t NB_BUFFERED_SAMPLES = 5;      // Could be an external setting
-  static constexpr uint64_t LOG_BATCH_SIZE = 1;           // Could be an external setting
-  static constexpr uint64_t LOG_TRIGGER_SIZE = NB_BUFFERED_SAMPLES + LOG_BATCH_SIZE - 1;
-  static_assert(NB_BUFFERED_SAMPLES >= MIN_NB_BUFFERED_SAMPLES);
-  static_assert(LOG_BATCH_SIZE > 0);
+  const size_t log_trigger_size = m_nb_buffered_samples + m_log_batch_size - 1;
 
   // Send overflow to log
-  if (m_step_data.size() >= LOG_TRIGGER_SIZE) {
-    while (m_step_data.size() >= NB_BUFFERED_SAMPLES) {
-      m_datalog->add_sample(std::move(m_step_data.front()));
+  if (m_step_data.size() >= log_trigger_size) {
+    while (m_step_data.size() >= m_nb_buffered_samples) {
+      m_datalog->add_sample(m_step_data.front());
       m_step_data.pop_front();
     }
   }
 }
 
-cogmentAPI::ActionSet Trial::make_action_set() {
-  cogmentAPI::ActionSet action_set;
-  action_set.set_timestamp(Timestamp());
+void Trial::make_action_set(cogmentAPI::ActionSet* action_set) {
+  action_set->set_timestamp(Timestamp());
 
-  action_set.set_tick_id(m_tick_id);
+  action_set->set_tick_id(m_tick_id);
 
   const std::lock_guard lg(m_sample_lock);
   auto& sample = m_step_data.back();
+  action_set->mutable_actions()->Reserve(sample.actions_size());
   for (auto& act : sample.actions()) {
     if (act.tick_id() == AUTO_TICK_ID || act.tick_id() == static_cast<int64_t>(m_tick_id)) {
-      action_set.add_actions(act.content());
+      action_set->add_actions(act.content());
     }
     else {
       // The registered action is not for this tick
 
       // TODO: Synchronize with `actor_acted` about past/future actions
-      action_set.add_actions();  // Add default action
+      action_set->add_actions();  // Add default action
     }
   }
-
-  return action_set;
 }
 
-bool Trial::finalize_env() {
-  static constexpr auto timeout = std::chrono::seconds(60);
-
+void Trial::finalize_env() {
   SPDLOG_DEBUG("Trial [{}] - Waiting (max 60 sec) for environment [{}] to acknowledge 'LAST'", m_id, m_env->name());
-  try {
-    auto fut = m_env->last_ack();
-    if (!fut.valid()) {
-      throw std::future_error(std::future_errc::no_state);
-    }
 
-    auto status = fut.wait_for(timeout);
-    switch (status) {
-    case std::future_status::deferred:
-      throw MakeException("Deferred last data");
-    case std::future_status::ready:
-      break;
-    case std::future_status::timeout:
-      throw MakeException("Last data wait timed out");
-    }
+  // Whichever comes first between the ack and the timeout proceeds
+  auto done = std::make_shared<std::atomic<bool>>(false);
 
-    return true;
-  }
-  catch (const std::exception& exc) {
-    spdlog::error("Trial [{}] - Environment [{}] last ack failed [{}]", m_id, m_env->name(), exc.what());
-  }
-  catch (...) {
-    spdlog::error("Trial [{}] - Environment [{}] last ack failed", m_id, m_env->name());
-  }
+  auto self = shared_from_this();
+  const auto timer_id = m_orchestrator->timers().schedule(ENV_LAST_ACK_TIMEOUT, [self, done]() {
+    if (!done->exchange(true)) {
+      spdlog::error("Trial [{}] - Environment [{}] last ack failed [Last data wait timed out]", self->m_id,
+                    self->m_env->name());
+      self->notify_end(false);
+    }
+  });
 
-  return false;
+  // The environment must not hold the trial alive
+  std::weak_ptr<Trial> weak_self = self;
+  m_env->last_ack().on_set([weak_self, done, timer_id]() {
+    auto self = weak_self.lock();
+    if (self != nullptr && !done->exchange(true)) {
+      self->m_orchestrator->timers().cancel(timer_id);
+      self->finalize_actors();
+    }
+  });
 }
 
 void Trial::finalize_actors() {
-  static constexpr auto timeout = std::chrono::seconds(30);
-
-  SPDLOG_DEBUG("Trial [{}] - Waiting (max 30 sec per actor) for all actors to acknowledge 'LAST'", m_id);
-
-  std::vector<std::future<void>> actors_last_ack;
-  actors_last_ack.reserve(m_actors.size());
-  for (auto& actor : m_actors) {
-    actors_last_ack.emplace_back(actor->last_ack());
+  SPDLOG_DEBUG("Trial [{}] - Waiting (max 30 sec) for all actors to acknowledge 'LAST'", m_id);
+
+  struct Finalization {
+    Finalization(size_t nb_actors) : done(false), nb_remaining(nb_actors), acked(nb_actors) {}
+
+    std::atomic<bool> done;
+    std::atomic<size_t> nb_remaining;
+    std::vector<std::atomic<bool>> acked;
+    TimerWheel::TimerId timer_id;
+  };
+  if (m_actors.empty()) {
+    notify_end(true);
+    return;
   }
+  auto state = std::make_shared<Finalization>(m_actors.size());
 
-  for (size_t index = 0; index < actors_last_ack.size(); index++) {
-    auto& fut = actors_last_ack[index];
+  // One deadline for all actors
+  auto self = shared_from_this();
+  state->timer_id = m_orchestrator->timers().schedule(ACTORS_LAST_ACK_TIMEOUT, [self, state]() {
+    if (!state->done.exchange(true)) {
+      for (size_t index = 0; index < self->m_actors.size(); index++) {
+        if (!state->acked[index]) {
+          spdlog::error("Trial [{}] - Actor [{}] last ack failed [Last data wait timed out]", self->m_id,
+                        self->m_actors[index]->actor_name());
+        }
+      }
+      self->notify_end(true);
+    }
+  });
 
-    try {
-      if (!fut.valid()) {
-        throw std::future_error(std::future_errc::no_state);
+  std::weak_ptr<Trial> weak_self = self;
+  for (size_t index = 0; index < m_actors.size(); index++) {
+    m_actors[index]->last_ack().on_set([weak_self, state, index]() {
+      state->acked[index] = true;
+      if (state->nb_remaining.fetch_sub(1) != 1) {
+        return;
       }
 
-      auto status = fut.wait_for(timeout);
-      switch (status) {
-      case std::future_status::deferred:
-        throw MakeException("Deferred last data");
-      case std::future_status::ready:
-        break;
-      case std::future_status::timeout:
-        throw MakeException("Last data wait timed out");
+      auto self = weak_self.lock();
+      if (self != nullptr && !state->done.exchange(true)) {
+        self->m_orchestrator->timers().cancel(state->timer_id);
+        self->notify_end(true);
       }
-    }
-    catch (const std::exception& exc) {
-      spdlog::error("Trial [{}] - Actor [{}] last ack failed [{}]", m_id, m_actors[index]->actor_name(), exc.what());
-    }
-    catch (...) {
-      spdlog::error("Trial [{}] - Actor [{}] last ack failed", m_id, m_actors[index]->actor_name());
-    }
+    });
   }
 }
 
-// This should be called within a lock of m_terminating_lock
-void Trial::finish() {
-  SPDLOG_TRACE("Trial [{}] - finish()", m_id);
-
-  if (m_state == InternalState::ended) {
-    return;
-  }
-  set_state(InternalState::terminating);
-
+void Trial::notify_end(bool env_finalized) {
   auto self = shared_from_this();
-  m_orchestrator->thread_pool().push("Trial finishing", [self]() {
-    SPDLOG_DEBUG("Trial [{}] - Finishing thread started", self->m_id);
-
-    const bool env_finalize_success = self->finalize_env();
-    if (env_finalize_success) {
-      self->finalize_actors();
-    }
-
+  m_orchestrator->thread_pool().push("Trial finishing", [self, env_finalized]() {
     try {
       std::string details;
-      if (!env_finalize_success) {
+      if (!env_finalized) {
         spdlog::warn("Trial [{}] - Force ending all actors because environment failed to end properly", self->m_id);
         details = "Environment failed to end properly";
       }
@@ -666,6 +735,19 @@ void Trial::finish() {
   });
 }
 
+// This should be called within a lock of m_terminating_lock
+void Trial::finish() {
+  SPDLOG_TRACE("Trial [{}] - finish()", m_id);
+
+  if (m_state == InternalState::ended) {
+    return;
+  }
+  set_state(InternalState::terminating);
+
+  // The end is driven by the acknowledgements and timers, no thread waits for them
+  finalize_env();
+}
+
 void Trial::request_end() {
   SPDLOG_TRACE("Trial [{}] - End requested", m_id);
   new_special_event("End requested");
@@ -720,6 +802,7 @@ void Trial::terminate(const std::string& details) {
 void Trial::env_observed(const std::string& env_name, cogmentAPI::ObservationSet&& obs, bool last) {
   const std::shared_lock lg(m_terminating_lock);
   refresh_activity();
+  const uint64_t obs_received = m_last_activity;
 
   if (m_state < InternalState::pending) {
     spdlog::warn("Trial [{}] - Environemnt [{}] too early to receive observations.", m_id, env_name);
@@ -748,8 +831,14 @@ void Trial::env_observed(const std::string& env_name, cogmentAPI::ObservationSet
   new_obs(std::move(obs));
 
   if (!last) {
+    m_obs_dispatch_timestamp = Timestamp();
     dispatch_observations(false);
+    observe_phase(&m_observation_dispatch_phase, m_observation_dispatch_phase.summary, obs_received);
+    wait_for_actions();
+
+    const uint64_t cycle_start = (m_sample_cycle_phase.summary != nullptr) ? Timestamp() : 0;
     cycle_buffer();
+    observe_phase(&m_sample_cycle_phase, m_sample_cycle_phase.summary, cycle_start);
   }
   else {
     spdlog::info("Trial [{}] - Environment has ended the trial", m_id);
@@ -759,10 +848,16 @@ void Trial::env_observed(const std::string& env_name, cogmentAPI::ObservationSet
   }
 }
 
-void Trial::actor_acted(const std::string& actor_name, cogmentAPI::Action&& action) {
+void Trial::actor_acted(uint32_t actor_index, cogmentAPI::Action&& action) {
   const std::shared_lock lg(m_terminating_lock);
   refresh_activity();
 
+  if (actor_index >= m_actors.size()) {
+    spdlog::error("Trial [{}] - Unknown actor index [{}] for action received.", m_id, actor_index);
+    return;
+  }
+  const auto& actor_name = m_actors[actor_index]->actor_name();
+
   if (m_state < InternalState::pending) {
     spdlog::warn("Trial [{}] - Actor [{}] too early in trial to receive action.", m_id, actor_name);
     return;
@@ -772,13 +867,6 @@ void Trial::actor_acted(const std::string& actor_name, cogmentAPI::Action&& acti
     return;
   }
 
-  const auto itor = m_actor_indexes.find(actor_name);
-  if (itor == m_actor_indexes.end()) {
-    spdlog::error("Trial [{}] - Unknown actor [{}] for action received.", m_id, actor_name);
-    return;
-  }
-  const auto actor_index = itor->second;
-
   auto sample = get_last_sample();
   if (sample == nullptr) {
     spdlog::debug("Trial [{}] - State [{}]. Action from [{}] lost", m_id, get_trial_state_string(m_state), actor_name);
@@ -791,6 +879,25 @@ void Trial::actor_acted(const std::string& actor_name, cogmentAPI::Action&& acti
     return;
   }
 
+  auto& action_state = m_action_states[actor_index];
+  const auto tick_id = m_tick_id;
+  const bool past_action = (action.tick_id() != AUTO_TICK_ID && action.tick_id() < static_cast<int64_t>(tick_id));
+  const bool defaulted = (past_action && static_cast<uint64_t>(action.tick_id()) < action_state.defaulted_tick);
+
+  // An action without tick answers the last observation dispatched to the actor:
+  // it is late if that tick was defaulted (until the next observation is dispatched)
+  const uint64_t defaulted_tick = action_state.defaulted_tick;
+  const bool late = (action.tick_id() == AUTO_TICK_ID && defaulted_tick > 0 &&
+                     defaulted_tick >= action_state.observed_tick);
+  if (defaulted || late || !mark_acted(actor_index, tick_id)) {
+    SPDLOG_DEBUG("Trial [{}] - Actor [{}] action arrived after its deadline. Data will be dropped.", m_id, actor_name);
+    if (m_metrics.late_actions != nullptr) {
+      m_metrics.late_actions->Increment();
+    }
+    return;
+  }
+  observe_phase(&m_actor_action_phase, action_state.action_time, m_obs_dispatch_timestamp);
+
   // TODO: Determine what we want to do in case of actions in the past or future
   if (action.tick_id() != AUTO_TICK_ID && action.tick_id() != static_cast<int64_t>(m_tick_id)) {
     spdlog::warn("Trial [{}] - Actor [{}] invalid action step: [{}] vs [{}]. Default action will be used.", m_id,
@@ -800,14 +907,185 @@ void Trial::actor_acted(const std::string& actor_name, cogmentAPI::Action&& acti
   SPDLOG_TRACE("Trial [{}] - Actor [{}] received action for tick [{}].", m_id, actor_name, m_tick_id);
   *sample_action = std::move(action);
 
+  count_action();
+}
+
+void Trial::actor_dead(uint32_t actor_index) {
+  if (actor_index >= m_action_states.size() || m_action_states[actor_index].dead.exchange(true)) {
+    return;
+  }
+
+  // Tested before locking because the actors are ended under the terminating lock (when not running)
+  if (m_state != InternalState::running) {
+    return;  // The next ticks take care of it, if any
+  }
+  const std::shared_lock lg(m_terminating_lock);
+  if (m_state != InternalState::running || m_env == nullptr) {
+    return;
+  }
+
+  spdlog::warn("Trial [{}] - Actor [{}] stream has closed. Default actions will be used.", m_id,
+               m_params.actors(actor_index).name());
+  default_action(actor_index, m_tick_id);
+}
+
+// Returns false if the actor has already acted for the tick (or a later tick)
+bool Trial::mark_acted(uint32_t actor_index, uint64_t tick_id) {
+  auto& acted_tick = m_action_states[actor_index].acted_tick;
+  uint64_t previous = acted_tick;
+  while (previous <= tick_id) {
+    if (acted_tick.compare_exchange_weak(previous, tick_id + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The action of the actor for the tick is left empty, so `make_action_set` uses the default action
+void Trial::default_action(uint32_t actor_index, uint64_t tick_id) {
+  if (!mark_acted(actor_index, tick_id)) {
+    return;
+  }
+  m_action_states[actor_index].defaulted_tick = tick_id + 1;
+
+  if (m_metrics.defaulted_actions != nullptr) {
+    m_metrics.defaulted_actions->Increment();
+  }
+  count_action();
+}
+
+// Called after the observations are dispatched, when the actors are expected to act
+void Trial::wait_for_actions() {
+  const auto tick_id = m_tick_id;
+  for (uint32_t index = 0; index < m_action_states.size(); index++) {
+    if (m_action_states[index].dead) {
+      default_action(index, tick_id);
+    }
+  }
+
+  if (!m_deadline_steps.empty() && m_nb_actors_acted < m_actors.size()) {
+    schedule_action_deadline(tick_id, 0);
+  }
+}
+
+void Trial::schedule_action_deadline(uint64_t tick_id, size_t step) {
+  uint64_t delay = m_deadline_steps[step];
+  if (step > 0) {
+    delay -= m_deadline_steps[step - 1];
+  }
+
+  // The timer must not hold the trial alive
+  std::weak_ptr<Trial> weak_self = shared_from_this();
+  m_action_timer = m_orchestrator->timers().schedule(std::chrono::nanoseconds(delay), [weak_self, tick_id, step]() {
+    auto self = weak_self.lock();
+    if (self != nullptr) {
+      auto& pool = self->thread_pool();
+      pool.push("Trial action deadline", [self = std::move(self), tick_id, step]() {
+        self->action_deadline_expired(tick_id, step);
+      });
+    }
+  });
+}
+
+void Trial::action_deadline_expired(uint64_t tick_id, size_t step) {
+  const std::shared_lock lg(m_terminating_lock);
+
+  if (m_state != InternalState::running || m_tick_id != tick_id) {
+    return;
+  }
+
+  const uint64_t deadline = m_deadline_steps[step];
+  for (uint32_t index = 0; index < m_action_states.size(); index++) {
+    const auto& action_state = m_action_states[index];
+    if (action_state.deadline > 0 && action_state.deadline <= deadline && action_state.acted_tick <= tick_id) {
+      SPDLOG_DEBUG("Trial [{}] - Actor [{}] missed the action deadline for tick [{}]", m_id,
+                   m_actors[index]->actor_name(), tick_id);
+      default_action(index, tick_id);
+    }
+  }
+
+  if (step + 1 < m_deadline_steps.size() && m_nb_actors_acted < m_actors.size()) {
+    schedule_action_deadline(tick_id, step + 1);
+  }
+}
+
+void Trial::prepare_phase_metrics() {
+  const prometheus::Labels env_labels {{"env_impl", m_params.environment().implementation()}};
+  if (m_metrics.observation_dispatch != nullptr) {
+    m_observation_dispatch_phase.summary =
+        &(m_metrics.observation_dispatch->Add(env_labels, prometheus::Summary::Quantiles()));
+  }
+  if (m_metrics.action_dispatch != nullptr) {
+    m_action_dispatch_phase.summary = &(m_metrics.action_dispatch->Add(env_labels, prometheus::Summary::Quantiles()));
+  }
+  if (m_metrics.sample_cycle != nullptr) {
+    m_sample_cycle_phase.summary = &(m_metrics.sample_cycle->Add(env_labels, prometheus::Summary::Quantiles()));
+  }
+
+  if (m_metrics.actor_action != nullptr) {
+    for (size_t index = 0; index < m_actors.size(); index++) {
+      m_action_states[index].action_time = &(m_metrics.actor_action->Add(
+          {{"actor_class", m_actors[index]->actor_class()}}, prometheus::Summary::Quantiles()));
+    }
+  }
+}
+
+// A start of 0 is not observed (e.g. not measured)
+void Trial::observe_phase(TickPhase* phase, prometheus::Summary* summary, uint64_t start) {
+  if (summary == nullptr || start == 0) {
+    return;
+  }
+
+  const uint64_t end = Timestamp();
+  const uint64_t duration = (end > start) ? (end - start) : 0;
+  summary->Observe(static_cast<double>(duration) * NANOS_INV);
+
+  uint64_t slowest = phase->slowest_duration;
+  while (duration > slowest) {
+    if (phase->slowest_duration.compare_exchange_weak(slowest, duration)) {
+      phase->slowest_tick_id = m_tick_id;
+      break;
+    }
+  }
+}
+
+void Trial::log_slowest_phases() const {
+  if (m_observation_dispatch_phase.summary == nullptr) {
+    return;
+  }
+
+  auto seconds = [](const TickPhase& phase) {
+    return static_cast<double>(phase.slowest_duration) * NANOS_INV;
+  };
+  spdlog::info(
+      "Trial [{}] - Slowest ticks: observation dispatch [{}s] at tick [{}], actor action [{}s] at tick [{}], "
+      "action dispatch [{}s] at tick [{}], sample cycle [{}s] at tick [{}]",
+      m_id, seconds(m_observation_dispatch_phase), m_observation_dispatch_phase.slowest_tick_id.load(),
+      seconds(m_actor_action_phase), m_actor_action_phase.slowest_tick_id.load(), seconds(m_action_dispatch_phase),
+      m_action_dispatch_phase.slowest_tick_id.load(), seconds(m_sample_cycle_phase),
+      m_sample_cycle_phase.slowest_tick_id.load());
+}
+
+void Trial::count_action() {
   const auto new_count = ++m_nb_actors_acted;
   if (new_count == m_actors.size()) {
     SPDLOG_TRACE("Trial [{}] - All actions received for tick [{}]", m_id, m_tick_id);
 
+    const auto timer_id = m_action_timer.exchange(0);
+    if (timer_id != 0) {
+      m_orchestrator->timers().cancel(timer_id);
+    }
+
     const bool last_actions = (m_tick_id >= m_max_steps || m_end_requested);
 
     if (!last_actions) {
-      m_env->dispatch_actions(make_action_set(), false);
+      const uint64_t dispatch_start = (m_action_dispatch_phase.summary != nullptr) ? Timestamp() : 0;
+      m_env->dispatch_actions(
+          [this](cogmentAPI::ActionSet* action_set) {
+            make_action_set(action_set);
+          },
+          false);
+      observe_phase(&m_action_dispatch_phase, m_action_dispatch_phase.summary, dispatch_start);
 
       // Here because we want this metric to be outside the first and last tick (i.e. overhead)
       if (m_metrics.tick_duration != nullptr) {
@@ -820,6 +1098,9 @@ void Trial::actor_acted(const std::string& actor_name, cogmentAPI::Action&& acti
           m_tick_start_timestamp = Timestamp();
         }
       }
+      if (m_metrics.tick_arena_heap_blocks != nullptr) {
+        m_metrics.tick_arena_heap_blocks->Observe(static_cast<double>(m_tick_arena_heap_blocks.exchange(0)));
+      }
     }
     else {
       // To signal the end to the environment. The end will come with the "last" observations.
@@ -834,7 +1115,11 @@ void Trial::actor_acted(const std::string& actor_name, cogmentAPI::Action&& acti
       }
 
       SPDLOG_DEBUG("Trial [{}] - Sending last actions to environment [{}]", m_id, m_env->name());
-      m_env->dispatch_actions(make_action_set(), true);
+      m_env->dispatch_actions(
+          [this](cogmentAPI::ActionSet* action_set) {
+            make_action_set(action_set);
+          },
+          true);
     }
   }
 }
@@ -949,12 +1234,23 @@ void Trial::set_state(InternalState new_state) {
       if (m_metrics.trial_duration != nullptr) {
         m_metrics.trial_duration->Observe(static_cast<double>(m_end_timestamp - m_start_timestamp) * NANOS_INV);
       }
+      log_slowest_phases();
+
+      m_orchestrator->trial_ended(m_id);
     }
   }
 }
 
 void Trial::refresh_activity() { m_last_activity = Timestamp(); }
 
+uint64_t Trial::inactivity_deadline() const {
+  const uint64_t last_activity = m_last_activity;
+  if (m_max_inactivity > std::numeric_limits<uint64_t>::max() - last_activity) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return last_activity + m_max_inactivity;
+}
+
 bool Trial::is_stale() {
   if (m_state == InternalState::ended) {
     return false;
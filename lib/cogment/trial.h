@@ -15,17 +15,21 @@
 #ifndef COGMENT_ORCHESTRATOR_TRIAL_H
 #define COGMENT_ORCHESTRATOR_TRIAL_H
 
+#include "cogment/arena_pool.h"
+#include "cogment/receiver_routes.h"
+#include "cogment/timer_wheel.h"
 #include "cogment/utils.h"
 
 #include "cogment/api/orchestrator.pb.h"
 #include "cogment/api/common.pb.h"
 #include "cogment/api/datalog.pb.h"
 
+#include "prometheus/counter.h"
+#include "prometheus/family.h"
 #include "prometheus/summary.h"
 
 #include <atomic>
 #include <memory>
-#include <deque>
 #include <mutex>
 #include <shared_mutex>
 #include <string>
@@ -33,10 +37,13 @@
 
 namespace cogment {
 class Orchestrator;
+class ClientEngine;
 class Environment;
 class Actor;
 class ClientActor;
 class DatalogService;
+class WarmTrial;
+struct ActorQueueOptions;
 
 // TODO: Make Trial independent of orchestrator (to remove any chance of circular reference)
 class Trial : public std::enable_shared_from_this<Trial> {
@@ -45,6 +52,16 @@ public:
   struct Metrics {
     prometheus::Summary* trial_duration = nullptr;
     prometheus::Summary* tick_duration = nullptr;
+    prometheus::Summary* tick_arena_heap_blocks = nullptr;
+    prometheus::Summary* actor_flushes = nullptr;
+    prometheus::Counter* late_actions = nullptr;
+    prometheus::Counter* defaulted_actions = nullptr;
+
+    // Tick phases, labeled by environment implementation or actor class
+    prometheus::Family<prometheus::Summary>* observation_dispatch = nullptr;
+    prometheus::Family<prometheus::Summary>* actor_action = nullptr;
+    prometheus::Family<prometheus::Summary>* action_dispatch = nullptr;
+    prometheus::Family<prometheus::Summary>* sample_cycle = nullptr;
   };
 
   static std::shared_ptr<Trial> make(Orchestrator* orch, const std::string& user_id, const std::string& id,
@@ -61,13 +78,23 @@ public:
   const std::string& id() const { return m_id; }
   const std::string& env_name() const;
   ThreadPool& thread_pool();
+  ClientEngine& client_engine();
+
+  // For messages built and sent during a tick
+  ArenaPool::Lease acquire_arena();
   const cogmentAPI::TrialParams& params() const { return m_params; }
 
+  // If the data sent to each actor during a tick is held and sent at once
+  bool tick_bundling() const { return m_tick_bundling; }
+  const ActorQueueOptions& actor_queue_options() const;
+
   InternalState state() const { return m_state; }
   uint64_t tick_id() const { return m_tick_id; }
 
   const std::vector<std::unique_ptr<Actor>>& actors() const { return m_actors; }
 
+  // Connections opened in advance for this trial (with the same id), used if they match the parameters at start
+  void set_warm_connections(std::unique_ptr<WarmTrial> warm_trial);
   void start(cogmentAPI::TrialParams&& params);
 
   ClientActor* get_join_candidate(const std::string& actor_name, const std::string& actor_class) const;
@@ -76,9 +103,15 @@ public:
   void terminate(const std::string& details);
 
   bool is_stale();
+  uint64_t max_inactivity() const { return m_max_inactivity; }
+
+  // Timestamp after which the trial will be stale if there is no more activity
+  uint64_t inactivity_deadline() const;
 
   void env_observed(const std::string& env_name, cogmentAPI::ObservationSet&& obs, bool last);
-  void actor_acted(const std::string& actor_name, cogmentAPI::Action&& action);
+  void actor_acted(uint32_t actor_index, cogmentAPI::Action&& action);
+  // The actor stream has closed: default actions are used for the actor from then on
+  void actor_dead(uint32_t actor_index);
   void reward_received(const std::string& source, cogmentAPI::Reward&& reward);
   void message_received(const std::string& source, cogmentAPI::Message&& message);
 
@@ -99,13 +132,25 @@ private:
   void new_special_event(std::string_view desc);
   void dispatch_observations(bool last);
   void cycle_buffer();
-  cogmentAPI::ActionSet make_action_set();
+  void make_action_set(cogmentAPI::ActionSet* action_set);
+  bool mark_acted(uint32_t actor_index, uint64_t tick_id);
+  void default_action(uint32_t actor_index, uint64_t tick_id);
+  void count_action();
+  void wait_for_actions();
+  void schedule_action_deadline(uint64_t tick_id, size_t step);
+  void action_deadline_expired(uint64_t tick_id, size_t step);
+  void prepare_phase_metrics();
+  struct TickPhase;
+  void observe_phase(TickPhase* phase, prometheus::Summary* summary, uint64_t start);
+  void log_slowest_phases() const;
   void dispatch_env_messages();
-  bool finalize_env();
+  void finalize_env();
   void finalize_actors();
+  void notify_end(bool env_finalized);
   void finish();
   std::vector<Actor*> get_all_actors(const std::string& name);
-  bool for_actors(const std::string& pattern, const std::function<void(Actor*)>& func);
+  template <class FUNC>
+  bool for_actors(const std::string& pattern, FUNC&& func);
 
   const std::string m_id;
   const std::string m_user_id;
@@ -126,17 +171,59 @@ private:
   bool m_end_requested;
   uint64_t m_tick_id;
   uint64_t m_tick_start_timestamp;
+  std::atomic<uint64_t> m_tick_arena_heap_blocks;
   std::atomic_uint m_nb_actors_acted;
   uint64_t m_max_steps;
   uint64_t m_max_inactivity;
 
+  std::unique_ptr<WarmTrial> m_warm_trial;
   std::unique_ptr<Environment> m_env;
   std::vector<std::unique_ptr<Actor>> m_actors;
   std::unordered_map<std::string, uint32_t> m_actor_indexes;
-  uint64_t m_last_activity;
-
-  std::deque<cogmentAPI::DatalogSample> m_step_data;
-  std::unique_ptr<DatalogService> m_datalog;
+  ReceiverRoutes m_receiver_routes;
+
+  // Actions of the current tick. The ticks are stored plus one (0 is no tick).
+  struct ActorActionState {
+    uint64_t deadline = 0;  // Nanoseconds after the observation is dispatched, 0 for no deadline
+    std::atomic<uint64_t> acted_tick {0};
+    std::atomic<uint64_t> defaulted_tick {0};
+    std::atomic<uint64_t> observed_tick {0};  // Last observation dispatched to the actor
+    std::atomic_bool dead {false};
+    prometheus::Summary* action_time = nullptr;
+  };
+  std::vector<ActorActionState> m_action_states;
+  std::vector<uint64_t> m_deadline_steps;  // Distinct actor deadlines, in increasing order
+  std::atomic<TimerWheel::TimerId> m_action_timer;
+  const uint64_t m_default_action_deadline;
+
+  // Duration of the parts of normal ticks, with the slowest tick of the trial (to find the trials behind the metrics)
+  struct TickPhase {
+    prometheus::Summary* summary = nullptr;  // Not used for actor actions (per actor)
+    std::atomic<uint64_t> slowest_duration {0};
+    std::atomic<uint64_t> slowest_tick_id {0};
+  };
+  TickPhase m_observation_dispatch_phase;
+  TickPhase m_actor_action_phase;
+  TickPhase m_action_dispatch_phase;
+  TickPhase m_sample_cycle_phase;
+  std::atomic<uint64_t> m_obs_dispatch_timestamp;
+
+  // Reward sources received, accumulated by their receivers when the observations are dispatched
+  struct PendingReward {
+    uint64_t tick_id;
+    const ReceiverRoutes::Indexes* receivers;
+    cogmentAPI::RewardSource source;
+  };
+  std::vector<PendingReward> m_pending_rewards;  // Protected by `m_reward_lock`
+  std::vector<PendingReward> m_dispatched_rewards;
+  std::atomic<uint64_t> m_last_activity;
+
+  const bool m_tick_bundling;
+  uint64_t m_nb_actor_flushes;
+  const size_t m_nb_buffered_samples;
+  const size_t m_log_batch_size;
+  RingBuffer<cogmentAPI::DatalogSample> m_step_data;
+  std::shared_ptr<DatalogService> m_datalog;
 };
 
 const char* get_trial_state_string(Trial::InternalState);
@@ -0,0 +1,95 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/trial_collector.h"
+#include "cogment/trial.h"
+
+#include "spdlog/spdlog.h"
+
+#include <chrono>
+#include <limits>
+
+namespace cogment {
+
+TrialCollector::TrialCollector(TrialRegistry* registry, TimerWheel* timers, ThreadPool* pool,
+                               DeleteFunction delete_func, prometheus::Summary* gc_metrics) :
+    m_registry(registry),
+    m_timers(timers),
+    m_pool(pool),
+    m_delete_func(std::move(delete_func)),
+    m_gc_metrics(gc_metrics) {}
+
+void TrialCollector::watch(const std::shared_ptr<Trial>& trial) {
+  const uint64_t deadline = trial->inactivity_deadline();
+  if (deadline == std::numeric_limits<uint64_t>::max()) {
+    return;
+  }
+
+  schedule_check(trial, deadline);
+}
+
+void TrialCollector::trial_ended(const std::string& trial_id) {
+  auto trial = m_registry->remove(trial_id);
+  if (trial != nullptr) {
+    SPDLOG_TRACE("Trial [{}] - Removed from registry", trial_id);
+    m_delete_func(std::move(trial));
+  }
+}
+
+void TrialCollector::schedule_check(std::weak_ptr<Trial>&& trial, uint64_t deadline) {
+  const uint64_t now = Timestamp();
+  const auto delay = std::chrono::nanoseconds((deadline > now) ? deadline - now : 0);
+
+  m_timers->schedule(delay, [this, trial = std::move(trial)]() mutable {
+    check(std::move(trial));
+  });
+}
+
+// Called in the timer thread
+void TrialCollector::check(std::weak_ptr<Trial>&& weak_trial) {
+  const auto start = Timestamp();
+
+  auto trial = weak_trial.lock();
+  if (trial == nullptr || trial->state() == Trial::InternalState::ended) {
+    return;
+  }
+
+  // There was activity since the timer was scheduled
+  const uint64_t deadline = trial->inactivity_deadline();
+  if (deadline > start) {
+    schedule_check(std::move(weak_trial), deadline);
+    return;
+  }
+
+  // In case the termination does not end the trial
+  schedule_check(std::move(weak_trial), start + trial->max_inactivity());
+
+  // Terminating trials may be long
+  m_pool->push("Stale trial termination", [trial]() {
+    if (trial->is_stale()) {
+      trial->terminate("The trial was inactive for too long");
+    }
+  });
+
+  if (m_gc_metrics != nullptr) {
+    const auto duration = Timestamp() - start;
+    m_gc_metrics->Observe(static_cast<double>(duration) * NANOS_INV);
+  }
+}
+
+}  // namespace cogment
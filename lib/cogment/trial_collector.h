@@ -0,0 +1,64 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_TRIAL_COLLECTOR_H
+#define COGMENT_ORCHESTRATOR_TRIAL_COLLECTOR_H
+
+#include "cogment/timer_wheel.h"
+#include "cogment/trial_registry.h"
+#include "cogment/utils.h"
+
+#include "prometheus/summary.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace cogment {
+
+class Trial;
+
+// Garbage collection of trials.
+// Ended trials are removed from the registry as soon as they are reported. Inactivity deadlines are timers
+// so that only trials whose deadline has passed are checked for staleness (and terminated).
+class TrialCollector {
+public:
+  using DeleteFunction = std::function<void(std::shared_ptr<Trial>&& trial)>;
+
+  // `delete_func` receives the trials removed from the registry (they should not be destroyed in the caller thread).
+  // The timers must be destroyed before the collector.
+  TrialCollector(TrialRegistry* registry, TimerWheel* timers, ThreadPool* pool, DeleteFunction delete_func,
+                 prometheus::Summary* gc_metrics);
+
+  TrialCollector(const TrialCollector&) = delete;
+  void operator=(const TrialCollector&) = delete;
+
+  // Starts checking the inactivity of the trial (must be started)
+  void watch(const std::shared_ptr<Trial>& trial);
+
+  void trial_ended(const std::string& trial_id);
+
+private:
+  void schedule_check(std::weak_ptr<Trial>&& trial, uint64_t deadline);
+  void check(std::weak_ptr<Trial>&& weak_trial);
+
+  TrialRegistry* const m_registry;
+  TimerWheel* const m_timers;
+  ThreadPool* const m_pool;
+  const DeleteFunction m_delete_func;
+  prometheus::Summary* const m_gc_metrics;
+};
+
+}  // namespace cogment
+#endif
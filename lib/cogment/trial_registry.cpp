@@ -0,0 +1,164 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/trial_registry.h"
+#include "cogment/utils.h"
+
+#include "spdlog/spdlog.h"
+
+namespace cogment {
+
+TrialRegistry::TrialRegistry(const Metrics& metrics) : m_metrics(metrics) {
+  static_assert((NB_SHARDS & (NB_SHARDS - 1)) == 0);
+}
+
+// Static
+size_t TrialRegistry::shard_index(const std::string& trial_id) {
+  return std::hash<std::string>()(trial_id) & (NB_SHARDS - 1);
+}
+
+const TrialRegistry::Shard& TrialRegistry::shard(const std::string& trial_id) const {
+  return m_shards[shard_index(trial_id)];
+}
+
+TrialRegistry::Shard& TrialRegistry::shard(const std::string& trial_id) { return m_shards[shard_index(trial_id)]; }
+
+template <class LockType>
+void TrialRegistry::lock(LockType& lock) const {
+  if (lock.try_lock()) {
+    return;
+  }
+
+  const auto start = Timestamp();
+  lock.lock();
+
+  if (m_metrics.contentions != nullptr) {
+    m_metrics.contentions->Increment();
+  }
+  if (m_metrics.wait_seconds != nullptr) {
+    m_metrics.wait_seconds->Increment(static_cast<double>(Timestamp() - start) * NANOS_INV);
+  }
+}
+
+bool TrialRegistry::insert(const std::string& trial_id, TrialPtr trial) {
+  auto& sh = shard(trial_id);
+  std::unique_lock ul(sh.lock, std::defer_lock);
+  lock(ul);
+
+  auto [itor, inserted] = sh.trials.emplace(trial_id, std::move(trial));
+  return inserted;
+}
+
+std::vector<bool> TrialRegistry::insert_batch(const std::vector<std::pair<std::string, TrialPtr>>& trials) {
+  std::vector<bool> result(trials.size(), false);
+
+  std::array<std::vector<size_t>, NB_SHARDS> shard_indexes;
+  for (size_t index = 0; index < trials.size(); index++) {
+    shard_indexes[shard_index(trials[index].first)].push_back(index);
+  }
+
+  for (size_t sh_index = 0; sh_index < NB_SHARDS; sh_index++) {
+    const auto& indexes = shard_indexes[sh_index];
+    if (indexes.empty()) {
+      continue;
+    }
+
+    auto& sh = m_shards[sh_index];
+    std::unique_lock ul(sh.lock, std::defer_lock);
+    lock(ul);
+
+    for (auto index : indexes) {
+      auto [itor, inserted] = sh.trials.emplace(trials[index].first, trials[index].second);
+      result[index] = inserted;
+    }
+  }
+
+  return result;
+}
+
+bool TrialRegistry::contains(const std::string& trial_id) const {
+  auto& sh = shard(trial_id);
+  std::shared_lock sl(sh.lock, std::defer_lock);
+  lock(sl);
+
+  return (sh.trials.find(trial_id) != sh.trials.end());
+}
+
+TrialRegistry::TrialPtr TrialRegistry::find(const std::string& trial_id) const {
+  auto& sh = shard(trial_id);
+  std::shared_lock sl(sh.lock, std::defer_lock);
+  lock(sl);
+
+  auto itor = sh.trials.find(trial_id);
+  if (itor != sh.trials.end()) {
+    return itor->second;
+  }
+  else {
+    return {};
+  }
+}
+
+TrialRegistry::TrialPtr TrialRegistry::remove(const std::string& trial_id) {
+  auto& sh = shard(trial_id);
+  std::unique_lock ul(sh.lock, std::defer_lock);
+  lock(ul);
+
+  TrialPtr result;
+  auto itor = sh.trials.find(trial_id);
+  if (itor != sh.trials.end()) {
+    result = std::move(itor->second);
+    sh.trials.erase(itor);
+  }
+
+  return result;
+}
+
+std::vector<TrialRegistry::TrialPtr> TrialRegistry::snapshot() const {
+  std::vector<TrialPtr> result;
+
+  for (auto& sh : m_shards) {
+    std::shared_lock sl(sh.lock, std::defer_lock);
+    lock(sl);
+
+    result.reserve(result.size() + sh.trials.size());
+    for (const auto& [id, trial] : sh.trials) {
+      result.push_back(trial);
+    }
+  }
+
+  return result;
+}
+
+void TrialRegistry::remove_if(const std::function<bool(TrialPtr& trial)>& func) {
+  for (auto& sh : m_shards) {
+    std::unique_lock ul(sh.lock, std::defer_lock);
+    lock(ul);
+
+    auto itor = sh.trials.begin();
+    while (itor != sh.trials.end()) {
+      if (func(itor->second)) {
+        itor = sh.trials.erase(itor);
+      }
+      else {
+        ++itor;
+      }
+    }
+  }
+}
+
+}  // namespace cogment
@@ -0,0 +1,90 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_TRIAL_REGISTRY_H
+#define COGMENT_ORCHESTRATOR_TRIAL_REGISTRY_H
+
+#include "prometheus/counter.h"
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cogment {
+
+class Trial;
+
+// Trials by id, split in independently locked shards.
+// Lookups only take a shared lock on one shard, and enumerations lock one shard at a time,
+// so they do not block each other nor the registration of trials in other shards.
+class TrialRegistry {
+public:
+  struct Metrics {
+    prometheus::Counter* contentions = nullptr;
+    prometheus::Counter* wait_seconds = nullptr;
+  };
+
+  using TrialPtr = std::shared_ptr<Trial>;
+
+  TrialRegistry(const Metrics& metrics);
+
+  TrialRegistry(const TrialRegistry&) = delete;
+  void operator=(const TrialRegistry&) = delete;
+
+  // Returns false if a trial with the same id is already registered
+  bool insert(const std::string& trial_id, TrialPtr trial);
+
+  // Each shard is locked once for all its trials. The result tells, for each trial, if it was inserted.
+  std::vector<bool> insert_batch(const std::vector<std::pair<std::string, TrialPtr>>& trials);
+
+  bool contains(const std::string& trial_id) const;
+  TrialPtr find(const std::string& trial_id) const;
+
+  // Returns the removed trial, or nullptr if not found
+  TrialPtr remove(const std::string& trial_id);
+
+  // Trials registered during the call may or may not be in the result
+  std::vector<TrialPtr> snapshot() const;
+
+  // The trials for which `func` returns true are removed.
+  // `func` is called with the shard locked, so it should be short (and must not use the registry).
+  void remove_if(const std::function<bool(TrialPtr& trial)>& func);
+
+private:
+  static constexpr size_t NB_SHARDS = 32;  // Must be a power of 2
+
+  struct Shard {
+    mutable std::shared_mutex lock;
+    std::unordered_map<std::string, TrialPtr> trials;
+  };
+
+  static size_t shard_index(const std::string& trial_id);
+  const Shard& shard(const std::string& trial_id) const;
+  Shard& shard(const std::string& trial_id);
+
+  // Locks and records contention if the lock could not be taken immediately
+  template <class LockType>
+  void lock(LockType& lock) const;
+
+  const Metrics m_metrics;
+  std::array<Shard, NB_SHARDS> m_shards;
+};
+
+}  // namespace cogment
+#endif
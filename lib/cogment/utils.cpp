@@ -18,6 +18,13 @@
 
 #include "cogment/utils.h"
 
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+
 #ifdef __linux__
   #include <string.h>
   #include <time.h>
@@ -56,99 +63,298 @@ std::vector<std::string> split(const std::string& in, char separator) {
   return result;
 }
 
-class ThreadPool::ThreadControl {
+void append_varint(std::string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void append_deterministic(std::string* out, const google::protobuf::MessageLite& msg) {
+  google::protobuf::io::StringOutputStream string_stream(out);
+  google::protobuf::io::CodedOutputStream coded_stream(&string_stream);
+  coded_stream.SetSerializationDeterministic(true);
+  msg.SerializeToCodedStream(&coded_stream);
+}
+
+bool read_varint(const char** pos, const char* end, uint64_t* value) {
+  constexpr unsigned int MAX_SHIFT = 63;
+
+  uint64_t result = 0;
+  for (unsigned int shift = 0; *pos < end && shift <= MAX_SHIFT; shift += 7) {
+    const auto byte = static_cast<uint8_t>(**pos);
+    (*pos)++;
+
+    result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+std::string split_url_query(const std::string& url, std::unordered_map<std::string, std::string>* query) {
+  const size_t query_pos = url.find('?');
+  if (query_pos == url.npos) {
+    return url;
+  }
+
+  const auto params = split(url.substr(query_pos + 1), '&');
+  for (const auto& param : params) {
+    if (param.empty()) {
+      continue;
+    }
+
+    const size_t equal_pos = param.find('=');
+    if (equal_pos == param.npos) {
+      (*query)[param] = "";
+    }
+    else {
+      (*query)[param.substr(0, equal_pos)] = param.substr(equal_pos + 1);
+    }
+  }
+
+  return url.substr(0, query_pos);
+}
+
+class ThreadPool::State : public std::enable_shared_from_this<ThreadPool::State> {
+  static constexpr auto IDLE_TIMEOUT = std::chrono::seconds(60);
+
+  struct Task {
+    FUNC_TYPE func;
+    std::promise<void> prom;
+    std::string description;
+  };
+
+  struct WorkQueue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  // Identifies the pool thread (if any) running in the current thread
+  struct Worker {
+    const State* state = nullptr;
+    size_t queue_index = 0;
+  };
+  static thread_local Worker t_worker;
+
 public:
-  bool is_available() const { return (!m_executing_func && m_active); }
+  State() :
+      m_queues(std::max(std::thread::hardware_concurrency(), 1u)),
+      m_min_threads(0),
+      m_max_threads(0),
+      m_nb_threads(0),
+      m_nb_idle(0),
+      m_nb_wakeups(0),
+      m_nb_spawned(0),
+      m_nb_pending(0),
+      m_next_queue(0),
+      m_stopping(false) {}
 
-  void stop() {
-    m_active = false;  // To stop once func is done
-    m_funcs.push({});  // To stop if there is no func running
+  void set_limits(size_t min_threads, size_t max_threads) {
+    if (max_threads != 0 && max_threads < min_threads) {
+      throw MakeException("Thread pool maximum [{}] is smaller than the minimum [{}]", max_threads, min_threads);
+    }
+
+    const std::lock_guard lg(m_lock);
+    m_min_threads = min_threads;
+    m_max_threads = max_threads;
+    while (m_nb_threads < m_min_threads) {
+      spawn_thread();
+    }
+    spdlog::debug("Thread pool limits set to [{}] - [{}]", m_min_threads, m_max_threads);
   }
 
-  std::future<void> set_execution(FUNC_TYPE&& func, std::string_view desc) {
+  std::future<void> push(std::string_view desc, FUNC_TYPE&& func) {
     if (!func) {
       throw MakeException("Non-callable function for thread pool [{}]", desc);
     }
 
-    m_executing_func = true;
-    m_prom = std::promise<void>();
-    m_description.assign(desc.data(), desc.size());
-    m_funcs.push(std::move(func));
-    return m_prom.get_future();
+    Task task;
+    task.func = std::move(func);
+    task.description.assign(desc.data(), desc.size());
+    auto fut = task.prom.get_future();
+
+    // Functions pushed from a pool thread stay on the same core queue
+    size_t index;
+    if (t_worker.state == this) {
+      index = t_worker.queue_index;
+    }
+    else {
+      index = m_next_queue++ % m_queues.size();
+    }
+    m_nb_pending++;
+    {
+      auto& queue = m_queues[index];
+      const std::lock_guard lg(queue.lock);
+      queue.tasks.emplace_back(std::move(task));
+    }
+
+    const std::lock_guard lg(m_lock);
+    if (m_nb_idle > 0) {
+      m_nb_idle--;
+      m_nb_wakeups++;
+      m_cond.notify_one();
+    }
+    else if (m_max_threads == 0 || m_nb_threads < m_max_threads) {
+      spawn_thread();
+    }
+
+    return fut;
   }
 
-  void run() {
-    m_active = true;
+  void stop() {
+    const std::lock_guard lg(m_lock);
+    m_stopping = true;
+    m_cond.notify_all();
+  }
 
-    try {
-      while (m_active) {
-        auto func = m_funcs.pop();
-        if (!func) {
-          break;
-        }
+private:
+  // Must be called with m_lock held
+  void spawn_thread() {
+    const size_t index = m_nb_spawned++ % m_queues.size();
+    m_nb_threads++;
 
-        try {
-          func();
-        }
-        catch (const std::exception& exc) {
-          spdlog::error("Threaded function [{}] failed [{}]", m_description, exc.what());
-        }
-        catch (...) {
-          spdlog::error("Threaded function [{}] failed", m_description);
-        }
-        m_prom.set_value();
-        m_executing_func = false;
+    std::thread thr([self = shared_from_this(), index]() {
+      self->run(index);
+    });
+    thr.detach();
+
+    SPDLOG_DEBUG("Nb of threads in pool: [{}]", m_nb_threads);
+  }
+
+  // All queues are used in FIFO order (stolen tasks are the oldest ones of the other queues)
+  bool pop_task(size_t index, Task* task) {
+    {
+      auto& queue = m_queues[index];
+      const std::lock_guard lg(queue.lock);
+      if (!queue.tasks.empty()) {
+        *task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        m_nb_pending--;
+        return true;
+      }
+    }
+
+    for (size_t offset = 1; offset < m_queues.size(); offset++) {
+      auto& queue = m_queues[(index + offset) % m_queues.size()];
+      const std::lock_guard lg(queue.lock);
+      if (!queue.tasks.empty()) {
+        *task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        m_nb_pending--;
+        return true;
       }
     }
+
+    return false;
+  }
+
+  static void execute(Task* task) {
+    try {
+      task->func();
+    }
     catch (const std::exception& exc) {
-      spdlog::error("Pooled thread failure: {}", exc.what());
+      spdlog::error("Threaded function [{}] failed [{}]", task->description, exc.what());
     }
     catch (...) {
-      spdlog::error("Pooled thread failure");
+      spdlog::error("Threaded function [{}] failed", task->description);
     }
+    task->prom.set_value();
+  }
 
-    m_active = false;
-    m_executing_func = false;
+  // Must be called with m_lock held
+  void thread_exiting() {
+    m_nb_threads--;
+    SPDLOG_DEBUG("Threadpool thread exiting, nb of threads in pool: [{}]", m_nb_threads);
   }
 
-private:
-  ThrQueue<FUNC_TYPE> m_funcs;
-  bool m_active = false;
-  bool m_executing_func = false;
-  std::promise<void> m_prom;
-  std::string m_description;
-};
+  // Returns false if the thread should exit (it is then already removed from the count of threads, so
+  // that concurrent idle threads see the right count when deciding to exit)
+  bool wait_for_task() {
+    std::unique_lock ul(m_lock);
+    if (m_stopping) {
+      thread_exiting();
+      return false;
+    }
+    if (m_nb_pending > 0) {
+      return true;
+    }
 
-ThreadPool::~ThreadPool() {
-  for (auto& ctrl : m_thread_controls) {
-    ctrl->stop();
-  }
-  for (auto& thr : m_thread_pool) {
-    thr.detach();
+    m_nb_idle++;
+    m_cond.wait_for(ul, IDLE_TIMEOUT, [this]() {
+      return (m_nb_wakeups > 0 || m_stopping);
+    });
+
+    if (m_nb_wakeups > 0) {
+      m_nb_wakeups--;
+      if (m_stopping) {
+        thread_exiting();
+        return false;
+      }
+      return true;
+    }
+
+    m_nb_idle--;
+    if (m_stopping || m_nb_threads > m_min_threads) {
+      thread_exiting();
+      return false;
+    }
+    return true;
   }
-}
 
-std::future<void> ThreadPool::push(std::string_view desc, FUNC_TYPE&& func) {
-  const std::lock_guard lg(m_push_lock);
+  void run(size_t index) {
+    t_worker.state = this;
+    t_worker.queue_index = index;
 
-  for (auto& control : m_thread_controls) {
-    if (control->is_available()) {
-      return control->set_execution(std::move(func), desc);
+    try {
+      Task task;
+      do {
+        while (pop_task(index, &task)) {
+          execute(&task);
+          task = Task();
+        }
+      } while (wait_for_task());
+    }
+    catch (const std::exception& exc) {
+      spdlog::error("Pooled thread failure: {}", exc.what());
+      const std::lock_guard lg(m_lock);
+      thread_exiting();
+    }
+    catch (...) {
+      spdlog::error("Pooled thread failure");
+      const std::lock_guard lg(m_lock);
+      thread_exiting();
     }
   }
 
-  auto& thr_control = add_thread();
-  return thr_control->set_execution(std::move(func), desc);
-}
+  std::vector<WorkQueue> m_queues;
 
-std::shared_ptr<ThreadPool::ThreadControl>& ThreadPool::add_thread() {
-  m_thread_controls.emplace_back(std::make_shared<ThreadControl>());
-  auto& thr_control = m_thread_controls.back();
-  m_thread_pool.emplace_back([thr_control]() {
-    thr_control->run();
-    spdlog::debug("Threadpool thread exiting");
-  });
+  std::mutex m_lock;
+  std::condition_variable m_cond;
+  size_t m_min_threads;
+  size_t m_max_threads;
+  size_t m_nb_threads;
+  size_t m_nb_idle;
+  size_t m_nb_wakeups;
+  size_t m_nb_spawned;
+  std::atomic<size_t> m_nb_pending;
+  std::atomic<size_t> m_next_queue;
+  bool m_stopping;
+};
 
-  spdlog::debug("Nb of threads in pool: [{}]", m_thread_controls.size());
-  return thr_control;
+thread_local ThreadPool::State::Worker ThreadPool::State::t_worker;
+
+ThreadPool::ThreadPool() : m_state(std::make_shared<State>()) {}
+
+// Threads still executing a function are left to finish on their own (they hold the state)
+ThreadPool::~ThreadPool() { m_state->stop(); }
+
+void ThreadPool::set_limits(size_t min_threads, size_t max_threads) { m_state->set_limits(min_threads, max_threads); }
+
+std::future<void> ThreadPool::push(std::string_view desc, FUNC_TYPE&& func) {
+  return m_state->push(desc, std::move(func));
 }
@@ -16,6 +16,7 @@
 #define COGMENT_ORCHESTRATOR_UTILS_H
 
 #include "grpc++/grpc++.h"
+#include "google/protobuf/message_lite.h"
 #include "spdlog/spdlog.h"
 
 #include <cstdarg>
@@ -26,6 +27,8 @@
 #include <future>
 #include <utility>
 #include <condition_variable>
+#include <functional>
+#include <unordered_map>
 
 constexpr uint64_t NANOS = 1'000'000'000;
 constexpr double NANOS_INV = 1.0 / NANOS;
@@ -34,6 +37,18 @@ using COGMENT_ERROR_BASE_TYPE = std::runtime_error;
 // Ignores (i.e. not added to the vector) the last empty string if there is a trailing separator
 std::vector<std::string> split(const std::string& in, char separator);
 
+// Splits "base?name1=value1&name2=value2", returns the base and adds the query parameters to `query`
+std::string split_url_query(const std::string& url, std::unordered_map<std::string, std::string>* query);
+
+// Same encoding as protobuf varints (e.g. compatible with protobuf length-delimited messages)
+void append_varint(std::string* out, uint64_t value);
+
+// Deterministic serialization (e.g. of maps), so that equal messages give equal bytes (e.g. for keys)
+void append_deterministic(std::string* out, const google::protobuf::MessageLite& msg);
+
+// Returns false if there is no complete varint before `end`. `pos` is moved past the varint.
+bool read_varint(const char** pos, const char* end, uint64_t* value);
+
 // Unix epoch time in nanoseconds
 uint64_t Timestamp();
 
@@ -122,12 +137,110 @@ private:
   std::condition_variable m_cond;
 };
 
-// Minimal thread pool
+// Event that happens once. Handlers are called when the event is set, or immediately if it is already set.
+class OneShotSignal {
+public:
+  OneShotSignal() : m_set(false) {}
+
+  // Only the first call has an effect
+  void set() {
+    std::unique_lock ul(m_lock);
+    if (m_set) {
+      return;
+    }
+    m_set = true;
+    auto handlers = std::move(m_handlers);
+    m_handlers.clear();
+    ul.unlock();
+
+    for (auto& handler : handlers) {
+      handler();
+    }
+  }
+
+  void on_set(std::function<void()>&& handler) {
+    std::unique_lock ul(m_lock);
+    if (!m_set) {
+      m_handlers.emplace_back(std::move(handler));
+      return;
+    }
+    ul.unlock();
+
+    handler();
+  }
+
+private:
+  std::mutex m_lock;
+  bool m_set;
+  std::vector<std::function<void()>> m_handlers;
+};
+
+// Fixed capacity FIFO of reusable objects (objects are not destroyed when popped,
+// they are given back by `push_back` with the content of their previous use).
+template <typename T>
+class RingBuffer {
+public:
+  RingBuffer(size_t capacity) : m_data(capacity), m_begin(0), m_size(0) {
+    if (capacity == 0) {
+      throw MakeException("Ring buffer must have a capacity");
+    }
+  }
+
+  size_t capacity() const { return m_data.size(); }
+  size_t size() const { return m_size; }
+  bool empty() const { return (m_size == 0); }
+  bool full() const { return (m_size == m_data.size()); }
+
+  T& front() {
+    if (m_size == 0) {
+      throw MakeException("Empty ring buffer has no front");
+    }
+    return m_data[m_begin];
+  }
+
+  T& back() {
+    if (m_size == 0) {
+      throw MakeException("Empty ring buffer has no back");
+    }
+    return m_data[(m_begin + m_size - 1) % m_data.size()];
+  }
+
+  // The returned object must be reset by the caller if needed
+  T& push_back() {
+    if (full()) {
+      throw MakeException("Ring buffer full [{}]", m_data.size());
+    }
+    m_size++;
+    return back();
+  }
+
+  void pop_front() {
+    if (m_size == 0) {
+      throw MakeException("Cannot pop from empty ring buffer");
+    }
+    m_begin = (m_begin + 1) % m_data.size();
+    m_size--;
+  }
+
+  void clear() {
+    m_begin = 0;
+    m_size = 0;
+  }
+
+private:
+  std::vector<T> m_data;
+  size_t m_begin;
+  size_t m_size;
+};
+
+// Bounded thread pool with per-core work queues and work stealing.
+// Threads are added when no thread is idle (up to the maximum), and
+// threads above the minimum are reaped after being idle for a while.
 class ThreadPool {
   using FUNC_TYPE = std::function<void()>;
 
 public:
-  ThreadPool() = default;
+  ThreadPool();
   ~ThreadPool();
 
   ThreadPool(const ThreadPool&) = delete;
@@ -135,16 +248,17 @@ public:
   void operator=(const ThreadPool&) = delete;
   void operator=(ThreadPool&& tpool) = delete;
 
+  // A max_threads of 0 means no limit. Functions pushed while all threads are busy at the
+  // maximum will wait for a thread to be available, so the maximum must account
+  // for functions that block for a long time.
+  void set_limits(size_t min_threads, size_t max_threads);
+
   // The future indicates that the execution of the function is finished
   std::future<void> push(std::string_view desc, FUNC_TYPE&& func);
 
 private:
-  class ThreadControl;
-  std::shared_ptr<ThreadControl>& add_thread();
-
-  std::vector<std::thread> m_thread_pool;
-  std::vector<std::shared_ptr<ThreadControl>> m_thread_controls;
-  std::mutex m_push_lock;
+  class State;
+  std::shared_ptr<State> m_state;
 };
 
 #endif
@@ -0,0 +1,262 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NDEBUG
+  #define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+#include "cogment/warm_trial_pool.h"
+#include "cogment/orchestrator.h"
+
+#include "spdlog/spdlog.h"
+#include "uuid.h"
+
+namespace {
+
+uuids::uuid_system_generator g_uuid_generator;
+
+bool is_client_endpoint(const std::string& endpoint) {
+  return (endpoint == "client" || endpoint == "cogment://client");
+}
+
+// Without the trial options in the query (e.g. action deadline)
+std::string actor_base_url(const std::string& endpoint) {
+  std::unordered_map<std::string, std::string> query;
+  return split_url_query(endpoint, &query);
+}
+
+}  // namespace
+
+namespace cogment {
+
+WarmTrial::~WarmTrial() {
+  for (auto& conn : m_environments) {
+    if (conn.stream != nullptr) {
+      conn.stream->cancel();
+      conn.stream->wait_done();
+    }
+  }
+  for (auto& conn : m_actors) {
+    if (conn.stream != nullptr) {
+      conn.stream->cancel();
+      conn.stream->wait_done();
+    }
+  }
+}
+
+bool WarmTrial::is_valid() const {
+  for (auto& conn : m_environments) {
+    if (conn.stream != nullptr && !conn.stream->is_valid()) {
+      return false;
+    }
+  }
+  for (auto& conn : m_actors) {
+    if (conn.stream != nullptr && !conn.stream->is_valid()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void WarmTrial::add_environment(const std::string& endpoint, Environment::StubEntryType&& stub_entry,
+                                std::shared_ptr<Environment::StreamType>&& stream) {
+  m_environments.push_back({endpoint, std::move(stub_entry), std::move(stream)});
+}
+
+void WarmTrial::add_actor(const std::string& endpoint, ClientStream::StubEntryType&& stub_entry,
+                          std::shared_ptr<ClientStream::StreamType>&& stream) {
+  m_actors.push_back({endpoint, std::move(stub_entry), std::move(stream)});
+}
+
+std::shared_ptr<Environment::StreamType> WarmTrial::take_environment(const std::string& endpoint,
+                                                                     Environment::StubEntryType* stub_entry) {
+  for (auto& conn : m_environments) {
+    if (conn.stream != nullptr && conn.endpoint == endpoint) {
+      *stub_entry = std::move(conn.stub_entry);
+      return std::move(conn.stream);
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<ClientStream::StreamType> WarmTrial::take_actor(const std::string& endpoint,
+                                                                ClientStream::StubEntryType* stub_entry) {
+  for (auto& conn : m_actors) {
+    if (conn.stream != nullptr && conn.endpoint == endpoint) {
+      *stub_entry = std::move(conn.stub_entry);
+      return std::move(conn.stream);
+    }
+  }
+  return nullptr;
+}
+
+WarmTrialPool::WarmTrialPool(Orchestrator* orch, size_t nb_per_profile, const Metrics& metrics) :
+    m_orchestrator(orch), m_nb_per_profile(nb_per_profile), m_metrics(metrics) {}
+
+// Static
+std::string WarmTrialPool::profile_key(const cogmentAPI::TrialParams& params) {
+  std::string key = params.environment().endpoint();
+  for (const auto& actor : params.actors()) {
+    auto url = actor_base_url(actor.endpoint());
+    if (!is_client_endpoint(url)) {
+      key.push_back('\n');
+      key.append(url);
+    }
+  }
+  return key;
+}
+
+void WarmTrialPool::add_profile(const cogmentAPI::TrialParams& params) {
+  if (m_nb_per_profile == 0 || params.environment().endpoint().empty()) {
+    return;
+  }
+  auto key = profile_key(params);
+
+  {
+    const std::lock_guard lg(m_lock);
+    if (m_profiles.size() >= MAX_NB_PROFILES) {
+      return;
+    }
+
+    auto [itor, inserted] = m_profiles.try_emplace(key);
+    if (!inserted) {
+      return;
+    }
+
+    auto& profile = itor->second;
+    profile.env_endpoint = params.environment().endpoint();
+    for (const auto& actor : params.actors()) {
+      auto url = actor_base_url(actor.endpoint());
+      if (!is_client_endpoint(url)) {
+        profile.actor_endpoints.emplace_back(std::move(url));
+      }
+    }
+  }
+
+  spdlog::debug("Keeping [{}] warm trials for environment [{}]", m_nb_per_profile, params.environment().endpoint());
+  fill(key);
+}
+
+std::unique_ptr<WarmTrial> WarmTrialPool::take(const cogmentAPI::TrialParams& params) {
+  if (m_nb_per_profile == 0) {
+    return nullptr;
+  }
+  auto key = profile_key(params);
+
+  std::unique_ptr<WarmTrial> result;
+  std::vector<std::unique_ptr<WarmTrial>> invalid_trials;  // Destroyed outside the lock
+  bool known_profile = false;
+  {
+    const std::lock_guard lg(m_lock);
+
+    auto itor = m_profiles.find(key);
+    if (itor != m_profiles.end()) {
+      known_profile = true;
+
+      auto& trials = itor->second.trials;
+      while (!trials.empty() && result == nullptr) {
+        auto trial = std::move(trials.front());
+        trials.pop_front();
+        if (m_metrics.size != nullptr) {
+          m_metrics.size->Decrement();
+        }
+
+        if (trial->is_valid()) {
+          result = std::move(trial);
+        }
+        else {
+          invalid_trials.emplace_back(std::move(trial));
+        }
+      }
+    }
+  }
+
+  if (result != nullptr) {
+    if (m_metrics.hits != nullptr) {
+      m_metrics.hits->Increment();
+    }
+  }
+  else if (m_metrics.misses != nullptr) {
+    m_metrics.misses->Increment();
+  }
+
+  if (known_profile) {
+    fill(key);
+  }
+  else {
+    add_profile(params);
+  }
+
+  return result;
+}
+
+std::unique_ptr<WarmTrial> WarmTrialPool::open(const std::string& env_endpoint,
+                                               const std::vector<std::string>& actor_endpoints) {
+  auto warm_trial = std::make_unique<WarmTrial>(to_string(g_uuid_generator()));
+  auto engine = &m_orchestrator->client_engine();
+
+  auto env_entry = m_orchestrator->env_pool()->get_stub_entry(env_endpoint);
+  auto env_stream = Environment::open_stream(engine, env_entry, warm_trial->trial_id());
+  warm_trial->add_environment(env_endpoint, std::move(env_entry), std::move(env_stream));
+
+  for (const auto& endpoint : actor_endpoints) {
+    auto actor_entry = m_orchestrator->agent_pool()->get_stub_entry(endpoint);
+    auto actor_stream = ServiceActor::open_stream(engine, actor_entry, warm_trial->trial_id());
+    warm_trial->add_actor(endpoint, std::move(actor_entry), std::move(actor_stream));
+  }
+
+  return warm_trial;
+}
+
+void WarmTrialPool::fill(const std::string& key) {
+  std::unique_lock ul(m_lock);
+  auto itor = m_profiles.find(key);
+  if (itor == m_profiles.end()) {
+    return;
+  }
+  auto& profile = itor->second;  // Profiles are never removed
+
+  const size_t nb_present = profile.trials.size() + profile.nb_opening;
+  if (nb_present >= m_nb_per_profile) {
+    return;
+  }
+  const size_t nb_missing = m_nb_per_profile - nb_present;
+  profile.nb_opening += nb_missing;
+  ul.unlock();
+
+  // Opening is asynchronous, so this is quick
+  std::vector<std::unique_ptr<WarmTrial>> new_trials;
+  try {
+    for (size_t count = 0; count < nb_missing; count++) {
+      new_trials.emplace_back(open(profile.env_endpoint, profile.actor_endpoints));
+    }
+  }
+  catch (const std::exception& exc) {
+    spdlog::debug("Failed to open warm trial connections for environment [{}]: {}", profile.env_endpoint, exc.what());
+  }
+  catch (...) {
+    spdlog::debug("Failed to open warm trial connections for environment [{}]", profile.env_endpoint);
+  }
+
+  ul.lock();
+  profile.nb_opening -= nb_missing;
+  for (auto& trial : new_trials) {
+    profile.trials.emplace_back(std::move(trial));
+    if (m_metrics.size != nullptr) {
+      m_metrics.size->Increment();
+    }
+  }
+}
+
+}  // namespace cogment
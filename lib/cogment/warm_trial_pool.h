@@ -0,0 +1,119 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COGMENT_ORCHESTRATOR_WARM_TRIAL_POOL_H
+#define COGMENT_ORCHESTRATOR_WARM_TRIAL_POOL_H
+
+#include "cogment/agent_actor.h"
+#include "cogment/environment.h"
+
+#include "cogment/api/orchestrator.pb.h"
+
+#include "prometheus/counter.h"
+#include "prometheus/gauge.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cogment {
+
+class Orchestrator;
+
+// Connections opened in advance for a trial (the trial id is part of the connection metadata).
+// The streams are waiting for the init data of the trial.
+class WarmTrial {
+public:
+  WarmTrial(const std::string& trial_id) : m_trial_id(trial_id) {}
+  ~WarmTrial();
+
+  WarmTrial(const WarmTrial&) = delete;
+  void operator=(const WarmTrial&) = delete;
+
+  const std::string& trial_id() const { return m_trial_id; }
+  bool is_valid() const;
+
+  void add_environment(const std::string& endpoint, Environment::StubEntryType&& stub_entry,
+                       std::shared_ptr<Environment::StreamType>&& stream);
+  void add_actor(const std::string& endpoint, ClientStream::StubEntryType&& stub_entry,
+                 std::shared_ptr<ClientStream::StreamType>&& stream);
+
+  // Return nullptr if there is no (unused) stream for the endpoint.
+  // The stub entry of the stream (i.e. the connection it was opened on) is also given in `stub_entry`.
+  std::shared_ptr<Environment::StreamType> take_environment(const std::string& endpoint,
+                                                            Environment::StubEntryType* stub_entry);
+  std::shared_ptr<ClientStream::StreamType> take_actor(const std::string& endpoint,
+                                                       ClientStream::StubEntryType* stub_entry);
+
+private:
+  template <class StubEntryType>
+  struct Connection {
+    std::string endpoint;
+    StubEntryType stub_entry;  // Keeps the channel open
+    std::shared_ptr<AsyncClientStream<grpc::ByteBuffer, grpc::ByteBuffer>> stream;
+  };
+
+  const std::string m_trial_id;
+  std::vector<Connection<Environment::StubEntryType>> m_environments;
+  std::vector<Connection<ClientStream::StubEntryType>> m_actors;
+};
+
+// Trials with connections opened in advance, for the trials started with the same endpoints (the profile).
+// A profile is added for the default parameters, and for new parameters when there is no warm trial for them.
+class WarmTrialPool {
+public:
+  struct Metrics {
+    prometheus::Gauge* size = nullptr;
+    prometheus::Counter* hits = nullptr;
+    prometheus::Counter* misses = nullptr;
+  };
+
+  WarmTrialPool(Orchestrator* orch, size_t nb_per_profile, const Metrics& metrics);
+
+  WarmTrialPool(const WarmTrialPool&) = delete;
+  void operator=(const WarmTrialPool&) = delete;
+
+  // Only the endpoints of the environment and service actors are used
+  void add_profile(const cogmentAPI::TrialParams& params);
+
+  // Returns nullptr if there is no warm trial for the profile of the parameters
+  std::unique_ptr<WarmTrial> take(const cogmentAPI::TrialParams& params);
+
+private:
+  static constexpr size_t MAX_NB_PROFILES = 16;
+
+  struct Profile {
+    std::string env_endpoint;
+    std::vector<std::string> actor_endpoints;
+    std::deque<std::unique_ptr<WarmTrial>> trials;
+    size_t nb_opening = 0;
+  };
+
+  static std::string profile_key(const cogmentAPI::TrialParams& params);
+  std::unique_ptr<WarmTrial> open(const std::string& env_endpoint, const std::vector<std::string>& actor_endpoints);
+  void fill(const std::string& key);
+
+  Orchestrator* const m_orchestrator;
+  const size_t m_nb_per_profile;
+  const Metrics m_metrics;
+
+  std::mutex m_lock;
+  std::unordered_map<std::string, Profile> m_profiles;
+};
+
+}  // namespace cogment
+#endif
@@ -21,6 +21,7 @@
 #include "cogment/utils.h"
 #include "cogment/versions.h"
 #include "cogment/services/actor_service.h"
+#include "cogment/services/trial_batch_service.h"
 #include "cogment/services/trial_lifecycle_service.h"
 
 #include "prometheus/exposer.h"
@@ -80,6 +81,36 @@ slt::Setting pre_trial_hooks = slt::Setting_builder<std::string>()
                                    .with_env_variable("COGMENT_PRE_TRIAL_HOOKS")
                                    .with_arg("pre_trial_hooks");
 
+slt::Setting pre_trial_hooks_timeout = slt::Setting_builder<std::uint32_t>()
+                                           .with_default(0)
+                                           .with_description("Pre-trial hook call timeout in seconds (0: no timeout)")
+                                           .with_env_variable("COGMENT_PRE_TRIAL_HOOKS_TIMEOUT")
+                                           .with_arg("pre_trial_hooks_timeout");
+
+slt::Setting pre_trial_hooks_async = slt::Setting_builder<bool>()
+                                         .with_default(false)
+                                         .with_description("Reply to trial starts before the end of pre-trial hooks")
+                                         .with_env_variable("COGMENT_PRE_TRIAL_HOOKS_ASYNC")
+                                         .with_arg("pre_trial_hooks_async");
+
+slt::Setting pre_trial_hooks_cache_size = slt::Setting_builder<std::uint32_t>()
+                                              .with_default(0)
+                                              .with_description("Number of pre-trial hook results cached (0: no cache)")
+                                              .with_env_variable("COGMENT_PRE_TRIAL_HOOKS_CACHE_SIZE")
+                                              .with_arg("pre_trial_hooks_cache_size");
+
+slt::Setting pre_trial_hooks_cache_ttl = slt::Setting_builder<std::uint32_t>()
+                                             .with_default(60)
+                                             .with_description("Time (in seconds) pre-trial hook results stay cached")
+                                             .with_env_variable("COGMENT_PRE_TRIAL_HOOKS_CACHE_TTL")
+                                             .with_arg("pre_trial_hooks_cache_ttl");
+
+slt::Setting warm_trials = slt::Setting_builder<std::uint32_t>()
+                               .with_default(0)
+                               .with_description("Number of trials prepared in advance per set of endpoints (0: none)")
+                               .with_env_variable("COGMENT_ORCHESTRATOR_WARM_TRIALS")
+                               .with_arg("warm_trials");
+
 slt::Setting deprecated_prometheus_port = slt::Setting_builder<std::string>()
                                               .with_default("")
                                               .with_description("DEPRECATED")
@@ -127,9 +158,87 @@ slt::Setting log_file = slt::Setting_builder<std::string>()
                             .with_arg("log_file");
 
 slt::Setting gc_frequency = slt::Setting_builder<std::uint32_t>()
-                                .with_default(10)
-                                .with_description("Number of trials between garbage collection runs")
+                                .with_default(0)
+                                .with_description("DEPRECATED")
                                 .with_arg("gc_frequency");
+
+slt::Setting min_threads = slt::Setting_builder<std::uint32_t>()
+                               .with_default(0)
+                               .with_description("Minimum number of threads kept in the thread pool")
+                               .with_env_variable("COGMENT_ORCHESTRATOR_MIN_THREADS")
+                               .with_arg("min_threads");
+
+slt::Setting max_threads = slt::Setting_builder<std::uint32_t>()
+                               .with_default(0)
+                               .with_description("Maximum number of threads in the thread pool (0 for no limit)")
+                               .with_env_variable("COGMENT_ORCHESTRATOR_MAX_THREADS")
+                               .with_arg("max_threads");
+
+slt::Setting nb_buffered_samples = slt::Setting_builder<std::uint32_t>()
+                                       .with_default(5)
+                                       .with_description("Number of trial samples buffered before logging")
+                                       .with_env_variable("COGMENT_ORCHESTRATOR_NB_BUFFERED_SAMPLES")
+                                       .with_arg("nb_buffered_samples");
+
+slt::Setting log_batch_size = slt::Setting_builder<std::uint32_t>()
+                                  .with_default(1)
+                                  .with_description("Number of trial samples sent to the datalog at once")
+                                  .with_env_variable("COGMENT_ORCHESTRATOR_LOG_BATCH_SIZE")
+                                  .with_arg("log_batch_size");
+
+slt::Setting actor_queue_size = slt::Setting_builder<std::uint32_t>()
+                                    .with_default(64)
+                                    .with_description("Maximum number of writes queued per client actor (0 for none)")
+                                    .with_env_variable("COGMENT_ORCHESTRATOR_ACTOR_QUEUE_SIZE")
+                                    .with_arg("actor_queue_size");
+
+slt::Setting datalog_queue_size = slt::Setting_builder<std::uint32_t>()
+                                      .with_default(1000)
+                                      .with_description("Maximum number of samples queued for the datalog of a trial")
+                                      .with_env_variable("COGMENT_ORCHESTRATOR_DATALOG_QUEUE_SIZE")
+                                      .with_arg("datalog_queue_size");
+
+slt::Setting datalog_overflow = slt::Setting_builder<std::string>()
+                                    .with_default("block")
+                                    .with_description("Datalog queue overflow policy (block, drop_oldest, spill)")
+                                    .with_env_variable("COGMENT_ORCHESTRATOR_DATALOG_OVERFLOW")
+                                    .with_arg("datalog_overflow");
+
+slt::Setting tick_bundling = slt::Setting_builder<bool>()
+                                 .with_default(false)
+                                 .with_description("Send the data for an actor at once for each tick")
+                                 .with_env_variable("COGMENT_ORCHESTRATOR_TICK_BUNDLING")
+                                 .with_arg("tick_bundling");
+
+slt::Setting action_deadline = slt::Setting_builder<std::uint32_t>()
+                                   .with_default(0)
+                                   .with_description("Milliseconds to act before default actions are used (0 for none)")
+                                   .with_env_variable("COGMENT_ORCHESTRATOR_ACTION_DEADLINE")
+                                   .with_arg("action_deadline");
+
+slt::Setting connections_per_endpoint = slt::Setting_builder<std::uint32_t>()
+                                            .with_default(1)
+                                            .with_description("Number of connections opened to each endpoint")
+                                            .with_env_variable("COGMENT_ORCHESTRATOR_CONNECTIONS_PER_ENDPOINT")
+                                            .with_arg("connections_per_endpoint");
+
+slt::Setting connection_selection = slt::Setting_builder<std::string>()
+                                        .with_default("least_loaded")
+                                        .with_description("Connection used for new streams (least_loaded, round_robin)")
+                                        .with_env_variable("COGMENT_ORCHESTRATOR_CONNECTION_SELECTION")
+                                        .with_arg("connection_selection");
+
+slt::Setting warm_up_timeout = slt::Setting_builder<std::uint32_t>()
+                                   .with_default(10)
+                                   .with_description("Startup connection warm-up timeout in seconds (0: no warm-up)")
+                                   .with_env_variable("COGMENT_ORCHESTRATOR_WARM_UP_TIMEOUT")
+                                   .with_arg("warm_up_timeout");
+
+slt::Setting warm_up_wait = slt::Setting_builder<bool>()
+                                .with_default(false)
+                                .with_description("Wait for the connection warm-up before being ready")
+                                .with_env_variable("COGMENT_ORCHESTRATOR_WARM_UP_WAIT")
+                                .with_arg("warm_up_wait");
 }  // namespace settings
 
 namespace {
@@ -382,8 +491,24 @@ int main(int argc, const char* argv[]) {
       }
     }
 
-    cogment::Orchestrator orchestrator(std::move(params), settings::gc_frequency.get(), client_creds,
-                                       metrics_registry.get());
+    if (settings::gc_frequency.get() != 0) {
+      spdlog::warn("Argument [{}] is deprecated: trials are garbage collected as they end or become stale",
+                   settings::gc_frequency.arg().value());
+    }
+
+    cogment::Orchestrator orchestrator(std::move(params), client_creds, metrics_registry.get());
+    orchestrator.thread_pool().set_limits(settings::min_threads.get(), settings::max_threads.get());
+    orchestrator.set_connections(settings::connections_per_endpoint.get(), settings::connection_selection.get());
+    orchestrator.set_sample_buffering(settings::nb_buffered_samples.get(), settings::log_batch_size.get());
+    orchestrator.set_datalog_queue(settings::datalog_queue_size.get(), settings::datalog_overflow.get());
+    orchestrator.set_actor_queue(settings::actor_queue_size.get());
+    orchestrator.set_tick_bundling(settings::tick_bundling.get());
+    orchestrator.set_action_deadline(settings::action_deadline.get());
+    orchestrator.set_prehook_timeout(settings::pre_trial_hooks_timeout.get());
+    orchestrator.set_prehook_async(settings::pre_trial_hooks_async.get());
+    orchestrator.set_prehook_cache(settings::pre_trial_hooks_cache_size.get(),
+                                   settings::pre_trial_hooks_cache_ttl.get());
+    orchestrator.set_warm_trials(settings::warm_trials.get());
 
     // ******************* Networking *******************
     int nb_prehooks = 0;
@@ -413,13 +538,20 @@ int main(int argc, const char* argv[]) {
     }
     spdlog::info("[{}] pre-trial hooks defined", nb_prehooks);
 
+    std::shared_future<void> warm_up_fut;
+    if (settings::warm_up_timeout.get() > 0) {
+      warm_up_fut = orchestrator.warm_up_connections(settings::warm_up_timeout.get());
+    }
+
     cogment::ActorService actor_service(&orchestrator);
     cogment::TrialLifecycleService trial_lifecycle_service(&orchestrator);
+    cogment::TrialBatchService trial_batch_service(&orchestrator);
     std::vector<std::unique_ptr<grpc::Server>> servers;
     {
       grpc::ServerBuilder builder;
       builder.AddListeningPort(lifecycle_endpoint, server_creds);
       builder.RegisterService(&trial_lifecycle_service);
+      builder.RegisterService(&trial_batch_service);
 
       // If the lifecycle endpoint is the same as the ClientActorSP, then run them
       // off the same server, otherwise, start a second server.
@@ -438,6 +570,10 @@ int main(int argc, const char* argv[]) {
       servers.emplace_back(std::move(server));
     }
 
+    if (settings::warm_up_wait.get() && warm_up_fut.valid()) {
+      warm_up_fut.wait();
+    }
+
     if (status_file.is_open() && status_file.good()) {
       status_file << READY_STATUS_STRING << std::flush;
     }
@@ -0,0 +1,142 @@
+// Copyright 2021 AI Redefined Inc. <dev+cogment@ai-r.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Decodes the delta encoded observations of "file://" datalog files (see `cogment::DatalogServiceFile`).
+// The input files (plain or gzip compressed) must be from the same trial, in order.
+// The output is an uncompressed datalog file with the header of the first input file.
+
+#include "cogment/datalog_delta.h"
+#include "cogment/utils.h"
+
+#include "spdlog/spdlog.h"
+
+#include <zlib.h>
+
+#include <cstdio>
+
+namespace {
+
+// Returns false at the end of the file
+bool read_record(gzFile file, std::string* record) {
+  constexpr unsigned int MAX_SHIFT = 63;
+
+  uint64_t size = 0;
+  unsigned int shift = 0;
+  for (;; shift += 7) {
+    const int byte = gzgetc(file);
+    if (byte < 0) {
+      if (shift == 0) {
+        return false;
+      }
+      throw MakeException("Truncated record size");
+    }
+    if (shift > MAX_SHIFT) {
+      throw MakeException("Invalid record size");
+    }
+
+    size |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      break;
+    }
+  }
+
+  record->resize(size);
+  if (size > 0 && gzread(file, record->data(), size) != static_cast<int>(size)) {
+    throw MakeException("Truncated record");
+  }
+
+  return true;
+}
+
+void write_record(FILE* file, const std::string& record) {
+  std::string size;
+  append_varint(&size, record.size());
+
+  if (std::fwrite(size.data(), 1, size.size(), file) != size.size() ||
+      std::fwrite(record.data(), 1, record.size(), file) != record.size()) {
+    throw MakeException("Failed to write output");
+  }
+}
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  if (argc < 3) {
+    std::fprintf(stderr, "Usage: %s <output file> <input file>...\n", argv[0]);
+    return 1;
+  }
+
+  FILE* output = std::fopen(argv[1], "wb");
+  if (output == nullptr) {
+    spdlog::error("Could not open output file [{}]", argv[1]);
+    return 1;
+  }
+
+  cogment::ObservationDeltaDecoder decoder;
+  cogmentAPI::DatalogSample sample;
+  std::string record;
+  size_t nb_samples = 0;
+  size_t nb_failed = 0;
+  int result = 0;
+
+  for (int arg_index = 2; arg_index < argc; arg_index++) {
+    const char* const filename = argv[arg_index];
+    gzFile input = gzopen(filename, "rb");
+    if (input == nullptr) {
+      spdlog::error("Could not open input file [{}]", filename);
+      result = 1;
+      break;
+    }
+
+    try {
+      // The header (trial parameters) is repeated in all files
+      if (!read_record(input, &record)) {
+        throw MakeException("Empty file");
+      }
+      if (arg_index == 2) {
+        write_record(output, record);
+      }
+
+      while (read_record(input, &record)) {
+        if (!sample.ParseFromString(record)) {
+          throw MakeException("Invalid sample record");
+        }
+
+        nb_samples++;
+        if (!decoder.decode(&sample)) {
+          nb_failed++;
+          continue;
+        }
+        write_record(output, sample.SerializeAsString());
+      }
+    }
+    catch (const std::exception& exc) {
+      spdlog::error("Failed to decode [{}]: {}", filename, exc.what());
+      result = 1;
+    }
+
+    gzclose(input);
+    if (result != 0) {
+      break;
+    }
+  }
+
+  if (std::fclose(output) != 0) {
+    spdlog::error("Failed to write output file [{}]", argv[1]);
+    result = 1;
+  }
+
+  spdlog::info("[{}] samples read, [{}] could not be decoded (missing base sample)", nb_samples, nb_failed);
+  return result;
+}